@@ -25,7 +25,7 @@
  | augeas_path_value                                     |
  |   path = "/head/label_a[pos1]/mid/label_b[pos2]/tail" |
  |   value = "value_a1_b1"                               |
- |   value_qq = "'value_a1_b1'" or "\"value_a1_b1\""     |
+ |   dict --> value_entry for "value_a1_b1"              |
  |   segments --.                                        |
  +---------------\---------------------------------------+
                   \
@@ -93,18 +93,87 @@ Each array-element points to a linked-list of tail_stub records, which contain
 a pointer to a (struct tail) record from the all_tails linked list
 The tails_at_position[position] linked-list give us a complete list of all the tail+value records
 for this position in the group, in their original order of appearance
+
+Each (struct tail) also points to a (struct tail_stats) record, which is shared by all tails in the group
+with the same simple_tail. These are used to find a group-wide key (eg. ipaddr for /etc/hosts) before
+searching for a tail position-by-position
 */
 
+/* Value dictionary - one value_entry for each distinct value in the file
+ * The regexp forms of the value are created on first use at output time, and shared by every
+ * path and tail with this value, in any group
+ * The quoted form is written directly to the output by out_quoted(), and never stored
+ */
+struct value_re {
+  unsigned int        width;        /* max_len given to regexp_value() */
+  char               *value_re;
+  struct value_re    *next;
+};
+
+struct value_entry {
+  char               *value;
+  struct value_re    *regexps;      /* Linked list, regexp_value(value, width) for each width used so far */
+  unsigned int        hash;
+  struct value_entry *next;         /* next entry in the same hash bucket */
+};
+
+/* Output sink - see out_reserve(), out_end_line(), out_flush()
+ * fd >= 0: the buffer is written to fd with write() whenever it fills, at the end of a line
+ * fd <  0: the output is kept in memory, in buf
+ */
+struct output_sink {
+  int     fd;                       /* -1 keeps everything in buf */
+  char   *buf;
+  size_t  len;                      /* bytes used in buf */
+  size_t  size;                     /* bytes allocated for buf */
+  augsuggest_writer writer;         /* if set, used instead of fd */
+  void   *writer_data;
+};
+
 /* all_tails record */
 struct tail {
   char         *simple_tail;
+  struct tail_stats *stats;             /* statistics shared by all tails with the same simple_tail within this group */
   char         *value;
-  char         *value_qq;               /* The value, quoted and escaped as-needed */
+  struct value_entry *dict;             /* value dictionary entry for value, NULL if value is NULL */
   char         *value_re;               /* The value expressed as a regular-expression, long enough to uniquely identify the value */
+  unsigned int  re_width;               /* minimum width of value_re to distinguish this value from others with the same simple_tail */
   struct tail  *next;                   /* next all_tails record */
   unsigned int  tail_value_found;       /* number of times we have seen this tail+value within this group, (used by 1st preference) */
   unsigned int *tail_value_found_map;   /* Array, indexed by position, number of times we have seen this tail+value within this group (used by 3rd preference) */
   unsigned int *tail_found_map;         /* Array, indexed by position, number of times we have seen this tail (regardless of value) within this group (used by 2nd preference) */
+  unsigned int  positions_seen;         /* number of positions containing this tail+value so far (used by degrade_group()) */
+  unsigned int  last_position_seen;     /* last position counted in positions_seen (used by degrade_group()) */
+};
+
+/* Statistics for each distinct simple_tail within a group, regardless of value
+ * Used by find_group_key() to find a tail which identifies every position within the group
+ */
+struct tail_stats {
+  char              *simple_tail;
+  struct tail       *tail;                  /* first (struct tail) created with this simple_tail - the others have copies of its tail_found_map[],
+                                             * kept the same by find_or_create_tail() */
+  unsigned int       occurrences;           /* number of times this simple_tail appears within the group */
+  unsigned int       distinct_values;       /* number of (struct tail) records with this simple_tail */
+  unsigned int       duplicates;            /* number of values which appear more than once */
+  unsigned int       unique_positions;      /* number of values which appear exactly once */
+  unsigned int       first_tail_positions;  /* number of positions where this simple_tail is the first_tail */
+  unsigned int       coverage;              /* number of positions where this simple_tail appears exactly once, kept by find_or_create_tail() */
+  unsigned long      value_cost;            /* sum of tail_cost() of the unique values, see key_cost() */
+  unsigned int       present_positions;     /* number of positions where this simple_tail appears, UINT_MAX if not yet counted */
+  unsigned int       pretty_width;          /* --pretty width for positions whose chosen_tail has this simple_tail */
+  struct tail_stats *next;
+};
+
+/* Known key for a group, for a given lens, eg. Hosts / ipaddr
+ * Built-in defaults, plus entries read from (and written back to) the --schema file
+ */
+struct key_schema {
+  char              *lens;       /* lens name, without any leading @ or trailing .lns, eg. Hosts */
+  char              *head;       /* pattern for the group head, relative to the file, with positions simplified, eg. /spec */
+  char              *key_tail;   /* simple_tail of the key, eg. /user */
+  int                builtin;    /* built-in default, not written to the --schema file */
+  struct key_schema *next;
 };
 
 /* Linked list of pointers into the all_tails list
@@ -127,8 +196,8 @@ struct subgroup {
 
 typedef enum {
     NOT_DONE=0,
-    FIRST_TAIL=1,                         /* 1st preference */
-    CHOSEN_TAIL_START=4,                  /* 2nd preference - unique tail found for this position */
+    FIRST_TAIL=1,                         /* 1st preference, or group key which is also the first tail */
+    CHOSEN_TAIL_START=4,                  /* 2nd preference (or group key) - unique tail found for this position */
     CHOSEN_TAIL_WIP=5,                    /* 2nd preference */
     CHOSEN_TAIL_DONE=6,                   /* 2nd preference */
     CHOSEN_TAIL_PLUS_FIRST_TAIL_START=8,  /* 3rd preference - unique tail found in a subgroup with a common first_tail */
@@ -141,19 +210,34 @@ typedef enum {
 struct group {
   char                   *head;
   struct tail            *all_tails;             /* Linked list */
+  struct tail_stats      *tail_stats;            /* Linked list, one record per distinct simple_tail */
+  struct tail_stats      *key;                   /* simple_tail which is present once at every position, or NULL - see find_group_key() */
+  char                   *schema_head;           /* head relative to the file, with positions simplified, used for --schema */
   struct tail_stub      **tails_at_position;     /* array of linked-lists, index is position */
   struct tail           **chosen_tail;           /* array of (struct tail)      pointers, index is position */
   struct tail_stub      **first_tail;            /* array of (struct tail_stub) pointers, index is position */
   unsigned int            max_position;          /* highest position seen for this group */
   unsigned int            position_array_size;   /* array size for arrays indexed by position, >= max_position+1, used for malloc() */
+  unsigned int            candidates_examined;   /* number of candidate tails examined by choose_tail() - see --max-candidates */
   chosen_tail_state_t    *chosen_tail_state;     /* array, index is position */
   struct subgroup        *subgroups;             /* Linked list, subgroups based on common first-tail - used only for 3rd preference and fallback */
   unsigned int           *subgroup_position;     /* array, position within subgroup for this position - used only for fallback */
+  /* For --query */
+  unsigned char          *selected;              /* array, index is position, non-zero if a --query path uses this position, NULL if none do */
   /* For --pretty */
   unsigned int           *pretty_width_ct;      /* array, index is position, value width to use for --pretty */
+  /* For output_segment() */
+  char                  **rendered;              /* array, index is position, rendered segment and [ expr ], NULL until first output */
+  unsigned int           *rendered_len;          /* array, index is position, length of rendered[] */
+  chosen_tail_state_t    *rendered_state;        /* array, index is position, the chosen_tail_state rendered[] was rendered for */
+  /* For --apply */
+  chosen_tail_state_t    *initial_state;         /* array, index is position, chosen_tail_state as set by choose_tail() */
   /* For --regexp */
   unsigned int           *re_width_ct;           /* array, index is position, matching width to use for --regexp */
   unsigned int           *re_width_ft;           /* array, index is position, matching width to use for --regexp */
+  /* For --group-profile */
+  double                  choose_time;           /* seconds (wall) in find_first_tail(), find_group_key() and choose_tail() */
+  double                  re_width_time;         /* seconds (wall) in choose_re_width() */
 };
 
 struct path_segment {
@@ -169,7 +253,203 @@ struct path_segment {
 struct augeas_path_value {
   char *path;
   char *value;
-  char *value_qq;            /* value in quotes - used in path-expressions, and as the value being assigned */
+  struct value_entry *dict;  /* value dictionary entry, NULL if value is NULL - out_quoted(value) is used in path-expressions, and as the value being assigned */
   /* result of split_path() */
   struct path_segment *segments;
+  int   selected;            /* matched by --query (or no --query given) - only selected paths are output */
+};
+
+/* --format=ndjson|binary - where each segment starts within the rendered path, see output_record() */
+struct record_segment {
+  struct path_segment *ps;
+  size_t               start;               /* offset of the segment in the rendered path */
+  size_t               label_len;           /* length of the label (including seq::*), the predicate follows it */
+  chosen_tail_state_t  chosen_tail_state;   /* state used to render the segment, NOT_DONE if there is no group */
+};
+
+/* --diff, one record per node in the live target */
+struct live_node {
+  char                     *path;      /* path below DIFF_LIVE */
+  const char               *value;
+  int                       matched;   /* non-zero if the node is also in the input, or is below a node being removed */
+  struct augeas_path_value *unit;      /* for the first node of a unit, the input path with the same first segment */
+};
+
+/* --group-profile, a group and its group_work(), computed once for sorting */
+struct group_rank {
+  struct group  *group;
+  unsigned long  work;
+};
+
+/* --stats, phases of a run, in the order they happen */
+typedef enum {
+  PHASE_AUG_INIT,
+  PHASE_LENS,            /* lens resolution, aug_transform(), --schema */
+  PHASE_LOAD_FILE,
+  PHASE_MOVE_TREE,
+  PHASE_MATCH,           /* aug_match() */
+  PHASE_VALUES,          /* aug_get() and lookup_value() */
+  PHASE_SPLIT_PATH,      /* split_path(), grouping */
+  PHASE_QUERY,           /* select_query_paths() */
+  PHASE_CHOOSE_TAILS,    /* choose_all_tails(), other than the following two */
+  PHASE_RE_WIDTH,        /* choose_re_width() */
+  PHASE_PRETTY_WIDTH,    /* choose_pretty_width() */
+  PHASE_DIFF,            /* --diff, load_live_target() */
+  PHASE_OUTPUT,
+  PHASE_APPLY,           /* --apply */
+  PHASE_VERIFY,          /* --verify */
+  NUM_PHASES
+} stats_phase_t;
+
+/* --stats, wall and CPU time in seconds */
+struct phase_time {
+  double wall;
+  double cpu;
+};
+
+/* --debug, subsystems with their own log level - see LOG() */
+typedef enum {
+  LOG_INGEST,    /* loading, aug_match(), values, split_path(), tails and stubs */
+  LOG_GROUP,     /* groups, subgroups, group keys, --query */
+  LOG_CHOOSE,    /* choose_tail() */
+  LOG_REGEXP,    /* choose_re_width() */
+  LOG_OUTPUT,    /* output, --apply, --diff */
+  NUM_LOG_SUBSYS
+} log_subsys_t;
+
+/* --debug levels */
+#define LOG_INFO     1   /* once per file, phase or option */
+#define LOG_DETAIL   2   /* once per group, position or path */
+#define LOG_ELEMENT  3   /* once per tail, stub or candidate, rate-limited */
+
+typedef enum { FORMAT_TEXT, FORMAT_NDJSON, FORMAT_BINARY } output_format_t;   /* --format */
+typedef enum { STATS_NONE, STATS_TEXT, STATS_JSON } show_stats_t;             /* --stats */
+
+/* --alloc-stats, the analysis structures whose allocations are counted */
+typedef enum {
+  ALLOC_SEGMENT,          /* struct path_segment, split_path() */
+  ALLOC_HEAD,             /* path_segment->head */
+  ALLOC_SIMPLE_TAIL,      /* str_simplified_tail(), path_segment->simplified_tail and group->schema_head */
+  ALLOC_GROUP,            /* struct group, and as->all_groups */
+  ALLOC_POSITION_ARRAYS,  /* the group arrays indexed by position, grow_position_arrays() and save_chosen_tail_states() */
+  ALLOC_TAIL,             /* struct tail and struct tail_stats, find_or_create_tail() */
+  ALLOC_TAIL_MAPS,        /* tail->tail_found_map and tail->tail_value_found_map, position_array_size each */
+  ALLOC_STUB,             /* struct tail_stub, append_tail_stub() */
+  ALLOC_SUBGROUP,         /* struct subgroup, matching_positions and group->subgroup_position */
+  ALLOC_REGEXP,           /* regexp_value() and struct value_re, value_regexp() */
+  ALLOC_RENDERED,         /* group->rendered quoted segments, output_segment() */
+  ALLOC_VALUE,            /* struct value_entry, lookup_value(), and the value_dict hash table, grow_value_dict() */
+  NUM_ALLOC_TYPES
+} alloc_type_t;
+
+/* --alloc-stats counters, per alloc_type_t and per stats_phase_t */
+struct alloc_count {
+  unsigned long count;    /* malloc() and realloc() calls */
+  size_t        bytes;    /* bytes requested by those calls */
+  size_t        live;     /* bytes allocated now */
+  size_t        peak;     /* highest value of live */
+};
+
+#define MAX_HELD 4   /* allocations held at once by hold() */
+
+/* The context behind the opaque augsuggest handle in libaugsuggest.h - everything for one input file
+ * Nothing is shared between contexts, so separate contexts may be used from separate threads
+ */
+struct augsuggest {
+  augeas *aug;
+  int     own_aug;                  /* aug was created by aug_init() here, and is closed by augsuggest_free() */
+  unsigned int flags;
+  unsigned int num_groups;
+  struct group **all_groups;
+  char  **all_matches;
+  int     num_matched;
+  struct augeas_path_value **all_augeas_paths; /* array of pointers */
+  char   *match_path;               /* aug_match() path-expression for every node of the input */
+  int     analysed;                 /* augsuggest_analyse() has been run */
+
+  /* Errors - see fatal() */
+  char   *error;                    /* message for augsuggest_error() */
+  jmp_buf fail;                     /* set by each API function, fatal() returns from it with -1 */
+  int     out_of_memory;
+  void   *held[MAX_HELD];           /* allocations for the current API call, freed by fatal() - see hold() */
+
+  /* Options - see augsuggest_set_option() */
+  int     verbose;
+  int     pretty;
+  int     noseq;
+  int     use_regexp;
+  int     use_defnode;
+  int     diff;                     /* --diff */
+  output_format_t output_format;    /* --format */
+  char   *lens;                     /* --lens, or inferred from --target */
+  char   *loadpath;
+  char   *target_file;              /* --target */
+  char   *root;                     /* --root, for --diff, default $AUGEAS_ROOT */
+  char  **queries;                  /* --query path-expressions */
+  int     num_queries;
+  /* Safety valves for pathological input, 0 = no limit */
+  unsigned int max_positions;       /* --max-positions */
+  unsigned int max_candidates;      /* --max-candidates */
+  double  time_limit;               /* --time-limit (seconds) */
+  struct timespec start_time;
+
+  /* Header lines of the script, see output_header() */
+  char   *input_file;               /* file loaded by augsuggest_load_file() or augsuggest_load_text() */
+  char   *default_lens;             /* --verbose, the lens which applies to input_file */
+  int     header;                   /* non-zero if the script starts by loading the file with lens */
+
+  /* --diff */
+  struct live_node  *live_nodes;    /* every node in the live target, in document order */
+  struct live_node **live_sorted;   /* live_nodes sorted by path, for find_live_node() */
+  int     num_live;
+
+  /* Known group keys - see find_group_key() */
+  char   *schema_file;              /* --schema */
+  char   *schema_lens;              /* lens name used to look up key_schemas */
+  char   *files_root;               /* /files/path/to/target - group heads are relative to this in key_schemas */
+  struct key_schema *key_schemas;
+
+  /* Value dictionary, hash table of value_entry records - see lookup_value() */
+  struct value_entry **value_dict;
+  unsigned int value_dict_size;
+  unsigned int value_dict_count;
+
+  struct output_sink out_sink;
+  int     out_api;                  /* render path-expressions for aug_set() and aug_match(), not for augtool */
+  const char *out_api_unquotable;   /* a value out_api_quoted() could not quote, reported by take_rendered() */
+
+  /* --format=ndjson|binary, scratch space reused by output_record() */
+  struct record_segment *record_segs;
+  unsigned int record_segs_size;
+  char   *record_path;
+  size_t  record_path_size;
+
+  /* --stats */
+  show_stats_t show_stats;
+  struct phase_time phase_times[NUM_PHASES];
+  struct phase_time phase_mark;     /* start of the current phase */
+  unsigned int state_counts[NO_CHILD_NODES+1];  /* positions resolved by each chosen_tail_state, counted after choose_all_tails() */
+
+  /* --alloc-stats */
+  show_stats_t alloc_stats;
+  int     count_allocs;             /* --alloc-stats or --trace, see ACCOUNT_ALLOC() */
+  struct alloc_count alloc_types[NUM_ALLOC_TYPES];
+  struct alloc_count alloc_phases[NUM_PHASES];  /* live and peak are for all types together, live is at the end of the phase */
+  struct alloc_count alloc_total;
+  struct alloc_count alloc_pending;  /* since phase_mark, added to the phase by stats_phase_end() */
+
+  /* --group-profile, number of groups to report, 0 for none */
+  unsigned int group_profile;
+
+  /* --debug, see log_msg() */
+  unsigned char log_level[NUM_LOG_SUBSYS];
+  unsigned int  log_limit;                        /* LOG_ELEMENT messages per subsystem, per phase and group */
+  unsigned int  log_count[NUM_LOG_SUBSYS];        /* LOG_ELEMENT messages since log_phase_end() */
+  char   *log_buf;                                /* messages not yet written to stderr */
+  size_t  log_len;
+  size_t  log_size;
+
+  /* --trace, chrome trace-event json */
+  FILE   *trace_fp;
+  int     trace_events;             /* number of events written, for the separating commas */
 };
@@ -0,0 +1,135 @@
+/* vim: expandtab:softtabstop=2:tabstop=2:shiftwidth=2
+ *
+ * Copyright (C) 2026 the augsuggest contributors
+ * -----------------------------------------------------------------------
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ * -----------------------------------------------------------------------
+ * augapply - measure the time augeas takes to apply augsuggest output
+ *
+ * Each script is run with aug_srun() against a freshly initialised augeas handle,
+ * the same way as
+ *     AUGEAS_ROOT=root augtool -f script --noload
+ * Only the aug_srun() call is timed, aug_init() and aug_close() are not
+ *
+ * eg. compare the cost of the predicates chosen with and without --regexp
+ *     ./augsuggest --target=/etc/hosts big.hosts > plain.augtool
+ *     ./augsuggest --target=/etc/hosts --regexp big.hosts > regexp.augtool
+ *     bench/augapply -n 5 -r /var/tmp/empty_root plain.augtool regexp.augtool
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <augeas.h>
+
+static double elapsed_ms(struct timespec *start, struct timespec *end) {
+  return( (end->tv_sec - start->tv_sec) * 1000.0 + (end->tv_nsec - start->tv_nsec) / 1000000.0 );
+}
+
+static char *read_script(const char *filename) {
+  FILE *fp;
+  char *text = NULL;
+  size_t size = 0;
+  fp = fopen(filename, "r");
+  if( fp == NULL ) {
+    perror(filename);
+    exit(1);
+  }
+  if( getdelim(&text, &size, '\0', fp) < 0 ) {
+    /* empty file */
+    text = strdup("");
+  }
+  fclose(fp);
+  return(text);
+}
+
+static int cmp_double(const void *a, const void *b) {
+  double da = *(const double *) a, db = *(const double *) b;
+  return( da < db ? -1 : da > db );
+}
+
+static void usage(const char *progname) {
+  fprintf(stdout, "Usage:\n\t%s [-n iterations] [-r augeas_root] [-s] script.augtool ...\n\n", progname);
+  fprintf(stdout, "\t  -n ... number of times to apply each script (default 3)\n");
+  fprintf(stdout, "\t  -r ... AUGEAS_ROOT to apply the script to (default $AUGEAS_ROOT or /)\n");
+  fprintf(stdout, "\t  -s ... also call aug_save() after each run (otherwise nothing is written)\n");
+}
+
+int main(int argc, char **argv) {
+  int opt;
+  int iterations = 3;
+  int save = 0;
+  char *root = getenv("AUGEAS_ROOT");
+
+  while( (opt = getopt(argc, argv, "n:r:sh")) != -1 ) {
+    switch(opt) {
+      case 'n':
+        iterations = atoi(optarg);
+        break;
+      case 'r':
+        root = optarg;
+        break;
+      case 's':
+        save = 1;
+        break;
+      default:
+        usage(argv[0]);
+        exit( opt == 'h' ? 0 : 1 );
+    }
+  }
+  if( optind >= argc || iterations < 1 ) {
+    usage(argv[0]);
+    exit(1);
+  }
+
+  printf("%-40s %6s %10s %10s %10s %8s\n", "script", "runs", "min_ms", "median_ms", "max_ms", "errors");
+  for( ; optind < argc; optind++ ) {
+    char *text = read_script(argv[optind]);
+    double *run_ms = malloc(sizeof(double) * iterations);
+    int errors = 0;
+    if( run_ms == NULL ) {
+      fprintf(stderr, "Out of memory\n");
+      exit(1);
+    }
+    for( int run=0; run < iterations; run++ ) {
+      struct timespec start, end;
+      augeas *aug;
+      FILE *devnull = fopen("/dev/null", "w");
+      aug = aug_init(root, NULL, AUG_NO_LOAD|AUG_NO_ERR_CLOSE);
+      if( aug == NULL || devnull == NULL ) {
+        fprintf(stderr, "%s: aug_init() failed\n", argv[0]);
+        exit(1);
+      }
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      if( aug_srun(aug, devnull, text) < 0 ) {
+        errors++;
+      }
+      if( save && aug_save(aug) < 0 ) {
+        errors++;
+      }
+      clock_gettime(CLOCK_MONOTONIC, &end);
+      run_ms[run] = elapsed_ms(&start, &end);
+      aug_close(aug);
+      fclose(devnull);
+    }
+    qsort(run_ms, iterations, sizeof(double), cmp_double);
+    printf("%-40s %6d %10.2f %10.2f %10.2f %8d\n", argv[optind], iterations, run_ms[0], run_ms[iterations/2], run_ms[iterations-1], errors);
+    free(run_ms);
+    free(text);
+  }
+  exit(0);
+}
@@ -0,0 +1,186 @@
+#!/bin/bash
+#
+# check.sh - regression gate: compare augsuggest output with stored golden scripts,
+#            and its time and peak memory with a stored baseline
+#
+# usage: bench/check.sh [record]
+#
+#   check.sh          run the gate, exit status is non-zero on any difference or regression,
+#                     or if there are no golden scripts and baseline
+#   check.sh record   (re)write the golden scripts from GOLDEN_REF, and the baseline from the current build
+#
+# Environment:
+#   AUGSUGGEST        augsuggest binary to run (default ./augsuggest)
+#   BENCH_DIR         directory for the corpus (default bench/corpus)
+#   GOLDEN_DIR        golden scripts and baseline (default bench/golden)
+#   GATE_SIZES        corpus sizes to check (default "100 1000")
+#   GATE_RUNS         runs per input, the fastest is used (default 3)
+#   GATE_TOLERANCE    allowed increase in time and peak memory, in percent (default 25)
+#   GATE_SLACK_MS     time differences below this are never regressions (default 5)
+#   GOLDEN_REF        git commit the golden scripts are generated by (default 06d51bdb591e, the code before
+#                     the cost model and the performance work), or "current" for the current build
+#
+# Each input is checked with each set of options in VARIANTS below
+# The golden scripts depend on the augeas version and lenses, so they are not committed: they are recorded
+# locally by building GOLDEN_REF in a temporary git worktree. Options GOLDEN_REF does not know are
+# reported as NOREF, and only their time and memory are checked.
+# The baseline is the time and memory of the build it is recorded with, so record it once from a known good build
+# (eg. the main branch) on the machine the gate runs on, and keep GOLDEN_DIR between runs (eg. in a CI cache)
+# Once an output change has been reviewed, accept it with GOLDEN_REF=current bench/check.sh record
+
+AUGSUGGEST=${AUGSUGGEST:-./augsuggest}
+BENCH_DIR=${BENCH_DIR:-bench/corpus}
+GOLDEN_DIR=${GOLDEN_DIR:-bench/golden}
+GATE_SIZES=${GATE_SIZES:-100 1000}
+GATE_RUNS=${GATE_RUNS:-3}
+GATE_TOLERANCE=${GATE_TOLERANCE:-25}
+GATE_SLACK_MS=${GATE_SLACK_MS:-5}
+GOLDEN_REF=${GOLDEN_REF:-06d51bdb591e1862524d9b5d5951b2f027f1653e}
+VARIANTS=( "" "--pretty --regexp" "--defnode" )
+
+. bench/kinds.sh
+
+mode=${1:-check}
+case $mode in
+  check|record) ;;
+  *) echo "usage: $0 [record]" >&2; exit 1 ;;
+esac
+
+for n in $GATE_SIZES; do
+  for kind in $KINDS; do
+    [ -f "$BENCH_DIR/$kind.$n" ] || bench/gencorpus.sh "$BENCH_DIR" $n || exit 1
+  done
+done
+
+baseline="$GOLDEN_DIR/baseline"
+if [ $mode = check ] && [ ! -f "$baseline" ]; then
+  echo "$0: no baseline in $GOLDEN_DIR - run 'make bench-record' with a known good build first" >&2
+  exit 1
+fi
+if [ $mode = record ]; then
+  mkdir -p "$GOLDEN_DIR" || exit 1
+  : > "$baseline.new"
+fi
+
+# build_ref
+# Build augsuggest at GOLDEN_REF in a temporary git worktree and set REF_AUGSUGGEST to it,
+# the worktree is removed on exit
+build_ref() {
+  if [ "$GOLDEN_REF" = current ]; then
+    REF_AUGSUGGEST=$AUGSUGGEST
+    return 0
+  fi
+  # LDLIBS, as the Makefile of 06d51bd puts -laugeas (in LDFLAGS) before the sources
+  if ! git rev-parse --verify -q "$GOLDEN_REF^{commit}" > /dev/null; then
+    echo "$0: GOLDEN_REF $GOLDEN_REF is not in this repository - set it to a commit to take the golden scripts from," >&2
+    echo "$0: or to \"current\" for the current build" >&2
+    return 1
+  fi
+  ref_dir=$(mktemp -d) || return 1
+  trap 'git worktree remove --force "$ref_dir/tree" > /dev/null 2>&1; rm -rf "$ref_dir"' EXIT
+  if ! git worktree add --detach "$ref_dir/tree" "$GOLDEN_REF" > /dev/null 2>&1 ||
+     ! make -C "$ref_dir/tree" augsuggest LDFLAGS= LDLIBS=-laugeas > "$ref_dir/build.log" 2>&1; then
+    echo "$0: could not build augsuggest at $GOLDEN_REF" >&2
+    cat "$ref_dir/build.log" >&2 2> /dev/null
+    return 1
+  fi
+  REF_AUGSUGGEST=$ref_dir/tree/augsuggest
+}
+
+# record_golden name input args...
+# Write the script GOLDEN_REF generates for input to $GOLDEN_DIR/name.augtool,
+# or $GOLDEN_DIR/name.noref if GOLDEN_REF does not know one of the options
+record_golden() {
+  local name=$1 input=$2
+  shift 2
+  rm -f "$GOLDEN_DIR/$name.augtool" "$GOLDEN_DIR/$name.noref"
+  if ! $REF_AUGSUGGEST "$@" "$input" > "$GOLDEN_DIR/$name.augtool" 2> "$BENCH_DIR/$name.ref"; then
+    rm -f "$GOLDEN_DIR/$name.augtool"
+    return 1
+  fi
+  if grep -q "unrecognized option" "$BENCH_DIR/$name.ref"; then
+    mv "$GOLDEN_DIR/$name.augtool" "$GOLDEN_DIR/$name.noref"
+  fi
+  return 0
+}
+
+if [ $mode = record ]; then
+  build_ref || exit 1
+fi
+
+# run_best name input args...
+# Run augsuggest GATE_RUNS times, keep the script of the last run in $BENCH_DIR/name.augtool
+# and set best_ms and best_kb to the fastest time and the smallest peak memory
+run_best() {
+  local name=$1 input=$2 run wall rss
+  shift 2
+  best_ms=""
+  best_kb=""
+  for (( run=0; run<GATE_RUNS; run++ )); do
+    if ! $AUGSUGGEST "$@" --stats "$input" > "$BENCH_DIR/$name.augtool" 2> "$BENCH_DIR/$name.stats"; then
+      return 1
+    fi
+    read wall rss < <(awk '$1 == "total" { wall = $2 } $1 == "process_peak_rss_kb" { rss = $2 } END { print wall, rss }' "$BENCH_DIR/$name.stats")
+    if [ -z "$best_ms" ] || awk -v a=$wall -v b=$best_ms 'BEGIN { exit !(a < b) }'; then
+      best_ms=$wall
+    fi
+    if [ -z "$best_kb" ] || [ $rss -lt $best_kb ]; then
+      best_kb=$rss
+    fi
+  done
+  return 0
+}
+
+rc=0
+for kind in $KINDS; do
+  for n in $GATE_SIZES; do
+    for args in "${VARIANTS[@]}"; do
+      name="$kind.$n$(echo "$args" | tr -d ' =-' | sed -e 's/^./.&/')"
+      if ! run_best $name "$BENCH_DIR/$kind.$n" $(kind_args $kind) $args; then
+        echo "FAILED    $name: augsuggest exited with an error, see $BENCH_DIR/$name.stats"
+        rc=1
+        continue
+      fi
+      if [ $mode = record ]; then
+        if ! record_golden $name "$BENCH_DIR/$kind.$n" $(kind_args $kind) $args; then
+          echo "FAILED    $name: $GOLDEN_REF exited with an error, see $BENCH_DIR/$name.ref"
+          rc=1
+          continue
+        fi
+        echo "$name $best_ms $best_kb" >> "$baseline.new"
+        echo "recorded  $name ${best_ms}ms ${best_kb}kB"
+        continue
+      fi
+
+      if [ -f "$GOLDEN_DIR/$name.noref" ]; then
+        echo "NOREF     $name: options not known to the golden reference, output not checked"
+      elif [ ! -f "$GOLDEN_DIR/$name.augtool" ]; then
+        echo "MISSING   $name: no golden script"
+        rc=1
+      elif ! cmp -s "$GOLDEN_DIR/$name.augtool" "$BENCH_DIR/$name.augtool"; then
+        echo "CHANGED   $name: output differs from $GOLDEN_DIR/$name.augtool"
+        rc=1
+      fi
+      read base_ms base_kb < <(awk -v name=$name '$1 == name { print $2, $3 }' "$baseline")
+      if [ -z "$base_ms" ]; then
+        echo "MISSING   $name: no baseline"
+        rc=1
+        continue
+      fi
+      verdict=$(awk -v ms=$best_ms -v kb=$best_kb -v base_ms=$base_ms -v base_kb=$base_kb -v tol=$GATE_TOLERANCE -v slack=$GATE_SLACK_MS 'BEGIN {
+        limit = base_ms * (1 + tol/100)
+        if( limit < base_ms + slack ) limit = base_ms + slack
+        if( ms > limit )                    print "SLOWER"
+        else if( kb > base_kb * (1 + tol/100) ) print "BIGGER"
+        else                                print "ok"
+      }')
+      printf "%-9s %s %sms (baseline %sms) %skB (baseline %skB)\n" $verdict $name $best_ms $base_ms $best_kb $base_kb
+      [ $verdict = ok ] || rc=1
+    done
+  done
+done
+
+if [ $mode = record ]; then
+  mv "$baseline.new" "$baseline"
+fi
+exit $rc
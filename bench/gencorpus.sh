@@ -0,0 +1,90 @@
+#!/bin/bash
+#
+# gencorpus.sh - generate synthetic input files of a given size, for bench/run.sh
+#
+# usage: bench/gencorpus.sh dir size ...
+#
+# For each size N, writes into dir
+#   hosts.N     N host entries, each with a unique ipaddr and 0-3 aliases
+#   squid.N     N acl lines, some acl names repeated, and an http_access line for every 10th acl
+#   sudoers.N   N user specs, the same few commands repeated for many users
+#   xml.N       N records, each nested 6 elements deep
+#   json.N      N records, each nested 6 objects deep
+#   dups.N      N host entries, only 10 of them different, between repeated comments
+#               this forces the 3rd preference and the position fallback in choose_tail()
+#
+# The files are the same on every run, so that results can be compared between runs
+
+if [ $# -lt 2 ]; then
+  echo "usage: $0 dir size ..." >&2
+  exit 1
+fi
+dir=$1
+shift
+mkdir -p "$dir" || exit 1
+
+for n in "$@"; do
+  awk -v n=$n 'BEGIN {
+    print "# generated hosts file"
+    print "127.0.0.1\tlocalhost localhost.localdomain"
+    for( i=1; i<=n; i++ ) {
+      line = sprintf("10.%d.%d.%d\thost%d.example.com", int(i/65536)%256, int(i/256)%256, i%256, i)
+      for( a=0; a<i%4; a++ )
+        line = line sprintf(" host%d-%d", i, a)
+      print line
+    }
+  }' > "$dir/hosts.$n"
+
+  awk -v n=$n 'BEGIN {
+    print "# generated squid.conf"
+    for( i=1; i<=n; i++ ) {
+      if( i%5 == 0 )
+        printf("acl Safe_ports port %d\n", 1024 + i)
+      else
+        printf("acl net%d src 10.%d.%d.0/24\n", i, int(i/256)%256, i%256)
+      if( i%10 == 1 )
+        printf("http_access allow net%d\n", i)
+    }
+    print "http_access deny all"
+    print "http_port 3128"
+  }' > "$dir/squid.$n"
+
+  awk -v n=$n 'BEGIN {
+    print "# generated sudoers"
+    print "Defaults   !requiretty"
+    print "Defaults    env_reset"
+    print "root\tALL=(ALL) \tALL"
+    for( i=1; i<=n; i++ ) {
+      if( i%3 == 0 )
+        printf("user%d\tALL=(root)\tNOPASSWD: /usr/bin/systemctl restart svc%d\n", i, i%7)
+      else
+        printf("%%group%d\tALL=(ALL)\t/usr/bin/cmd%d, /usr/bin/cmd%d\n", i, i%5, (i+1)%5)
+    }
+  }' > "$dir/sudoers.$n"
+
+  awk -v n=$n 'BEGIN {
+    print "<?xml version=\"1.0\"?>"
+    print "<records>"
+    for( i=1; i<=n; i++ ) {
+      printf("  <record id=\"r%d\"><a><b><c><d><e name=\"e%d\">value %d</e></d></c></b></a></record>\n", i, i%10, i)
+    }
+    print "</records>"
+  }' > "$dir/xml.$n"
+
+  awk -v n=$n 'BEGIN {
+    print "{ \"records\": ["
+    for( i=1; i<=n; i++ ) {
+      printf("  { \"id\": \"r%d\", \"a\": { \"b\": { \"c\": { \"d\": { \"e\": \"value %d\" } } } } }%s\n", i, i, i<n ? "," : "")
+    }
+    print "] }"
+  }' > "$dir/json.$n"
+
+  awk -v n=$n 'BEGIN {
+    print "# generated hosts file with duplicates"
+    for( i=1; i<=n; i++ ) {
+      if( i%5 == 1 )
+        print "# ------"
+      printf("192.0.2.%d\tdup%d\n", i%10, i%10)
+    }
+  }' > "$dir/dups.$n"
+done
@@ -0,0 +1,14 @@
+# kinds.sh - the kinds of input written by bench/gencorpus.sh, sourced by bench/run.sh and bench/check.sh
+
+KINDS="hosts squid sudoers xml json dups"
+
+# options to parse each kind of input as the file it pretends to be
+kind_args() {
+  case $1 in
+    hosts|dups) echo "--target=/etc/hosts" ;;
+    squid)      echo "--target=/etc/squid/squid.conf" ;;
+    sudoers)    echo "--target=/etc/sudoers" ;;
+    xml)        echo "--lens=Xml.lns --target=/etc/bench.xml" ;;
+    json)       echo "--lens=Json.lns --target=/etc/bench.json" ;;
+  esac
+}
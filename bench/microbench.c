@@ -0,0 +1,318 @@
+/* vim: expandtab:softtabstop=2:tabstop=2:shiftwidth=2
+ *
+ * Copyright (C) 2026 the augsuggest contributors
+ * -----------------------------------------------------------------------
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ * -----------------------------------------------------------------------
+ * microbench - time the string kernels and ingestion primitives of libaugsuggest in isolation
+ *
+ * The input file is loaded and analysed as usual, then each kernel is run over every path
+ * and value of the input, until it has run for at least 200ms (or -n times)
+ * Reports the time per call (ns/op) and the number of allocations per call (allocs/op)
+ *
+ * usage: bench/microbench [-n iterations] [--option[=value] ...] file
+ *        the options are the augsuggest options for the file, eg.
+ *     bench/microbench --target=/etc/hosts bench/corpus/hosts.1000
+ *
+ * libaugsuggest.c is included directly, to reach its static functions
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <augeas.h>
+#include <errno.h>
+#include <malloc.h>
+#include <time.h>
+#include <fnmatch.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <setjmp.h>
+#include <sys/param.h>
+#include <sys/resource.h>
+
+/* Count the allocations made by libaugsuggest - the system headers are already included above,
+ * so these only apply to the code below
+ */
+static unsigned long bench_allocs = 0;
+#define malloc(size)                (bench_allocs++, malloc(size))
+#define calloc(n, size)             (bench_allocs++, calloc(n, size))
+#define realloc(ptr, size)          (bench_allocs++, realloc(ptr, size))
+#define reallocarray(ptr, n, size)  (bench_allocs++, reallocarray(ptr, n, size))
+#define strdup(str)                 (bench_allocs++, strdup(str))
+#define strndup(str, n)             (bench_allocs++, strndup(str, n))
+#define asprintf(...)               (bench_allocs++, asprintf(__VA_ARGS__))
+#define vasprintf(...)              (bench_allocs++, vasprintf(__VA_ARGS__))
+
+#include "../libaugsuggest.c"
+
+#define MIN_TIME 0.2   /* seconds, each kernel is repeated for at least this long, unless -n is given */
+
+static unsigned long iterations = 0;
+
+static double now_seconds(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return( now.tv_sec + now.tv_nsec / 1e9 );
+}
+
+static void report(const char *name, unsigned long ops, double seconds, unsigned long allocs) {
+  if( ops == 0 ) {
+    printf("%-28s %12s\n", name, "no input");
+    return;
+  }
+  printf("%-28s %12lu %10.1f %10.2f\n", name, ops, seconds * 1e9 / ops, (double) allocs / ops);
+}
+
+/* The kernels - each runs over the whole input once, and returns the number of calls made */
+
+static unsigned long run_str_next_pos(struct augsuggest *as) {
+  unsigned long ops = 0;
+  int ndx;
+  for( ndx=0; ndx<as->num_matched; ndx++ ) {
+    char *s = as->all_augeas_paths[ndx]->path;
+    char *head_end;
+    unsigned int position;
+    while( *s ) {
+      s = str_next_pos(s, &head_end, &position);
+      ops++;
+    }
+  }
+  return(ops);
+}
+
+static unsigned long run_str_simplified_tail(struct augsuggest *as) {
+  unsigned long ops = 0;
+  int ndx;
+  for( ndx=0; ndx<as->num_matched; ndx++ ) {
+    char *s = as->all_augeas_paths[ndx]->path;
+    char *head_end;
+    unsigned int position;
+    while( *s ) {
+      s = str_next_pos(s, &head_end, &position);
+      free(str_simplified_tail(as, s));
+      ops++;
+    }
+  }
+  return(ops);
+}
+
+/* each value is compared with the next one, as find_or_create_tail() does for tails in a group */
+static unsigned long run_value_cmp(struct augsuggest *as) {
+  unsigned long ops = 0;
+  unsigned int matched;
+  int ndx;
+  for( ndx=1; ndx<as->num_matched; ndx++ ) {
+    value_cmp(as, as->all_augeas_paths[ndx-1]->value, as->all_augeas_paths[ndx]->value, &matched);
+    ops++;
+  }
+  return(ops);
+}
+
+static unsigned long run_quote(struct augsuggest *as) {
+  static char *buf = NULL;
+  static size_t buf_size = 0;
+  unsigned long ops = 0;
+  int ndx;
+  for( ndx=0; ndx<as->num_matched; ndx++ ) {
+    char *value = as->all_augeas_paths[ndx]->value;
+    char quote;
+    unsigned int len;
+    if( value == NULL )
+      continue;
+    len = quoted_length(value, &quote);
+    if( len > buf_size ) {
+      buf_size = len * 2;
+      buf = realloc(buf, buf_size);
+      CHECK_OOM( ! buf, fail_oom, "in run_quote()");
+    }
+    quote_into(buf, value, quote);
+    ops++;
+  }
+  return(ops);
+}
+
+static unsigned long run_regexp_value(struct augsuggest *as) {
+  unsigned long ops = 0;
+  int ndx;
+  for( ndx=0; ndx<as->num_matched; ndx++ ) {
+    char *value = as->all_augeas_paths[ndx]->value;
+    if( value == NULL )
+      continue;
+    free(regexp_value(as, value, 8));
+    ops++;
+  }
+  return(ops);
+}
+
+/* each path, and a copy with /./ and // added, which cleanup_filepath() has to remove */
+static unsigned long run_cleanup_filepath(struct augsuggest *as) {
+  static char *buf = NULL;
+  static size_t buf_size = 0;
+  unsigned long ops = 0;
+  int ndx;
+  for( ndx=0; ndx<as->num_matched; ndx++ ) {
+    char *path = as->all_augeas_paths[ndx]->path;
+    size_t len = strlen(path);
+    if( len + 8 > buf_size ) {
+      buf_size = len * 2 + 8;
+      buf = realloc(buf, buf_size);
+      CHECK_OOM( ! buf, fail_oom, "in run_cleanup_filepath()");
+    }
+    memcpy(buf, path, len + 1);
+    cleanup_filepath(buf);
+    snprintf(buf, buf_size, "/./%s//", path);
+    cleanup_filepath(buf);
+    ops += 2;
+  }
+  return(ops);
+}
+
+/* cmp_group_ptr()
+ * qsort() and bsearch() comparison for (struct group *), by address
+ */
+static int cmp_group_ptr(const void *p1, const void *p2) {
+  const struct group *g1 = *(struct group * const *) p1;
+  const struct group *g2 = *(struct group * const *) p2;
+  return( g1 < g2 ? -1 : g1 > g2 );
+}
+
+/* run_find_or_create_tail()
+ * Replay every segment of the input into empty copies of its group in a scratch context
+ * Only the find_or_create_tail() calls are timed, creating and freeing the groups is not
+ */
+static unsigned long run_find_or_create_tail(struct augsuggest *as, double *seconds, unsigned long *allocs) {
+  struct augsuggest *scratch = augsuggest_new();
+  struct group **sorted;
+  unsigned long ops = 0, allocs_before;
+  unsigned int ndx;
+  double start;
+  int path_ndx;
+
+  sorted = malloc(sizeof(struct group *) * (as->num_groups + 1));
+  CHECK_OOM( ! sorted, fail_oom, "in run_find_or_create_tail()");
+  memcpy(sorted, as->all_groups, sizeof(struct group *) * as->num_groups);
+  qsort(sorted, as->num_groups, sizeof(struct group *), cmp_group_ptr);
+  for( ndx=0; ndx<as->num_groups; ndx++ ) {
+    struct group *group = find_or_create_group(scratch, sorted[ndx]->head);
+    group->max_position = sorted[ndx]->max_position;
+    grow_position_arrays(scratch, group, group->max_position);
+  }
+
+  allocs_before = bench_allocs;
+  start = now_seconds();
+  for( path_ndx=0; path_ndx<as->num_matched; path_ndx++ ) {
+    struct augeas_path_value *path_value = as->all_augeas_paths[path_ndx];
+    struct path_segment *ps_ptr;
+    for( ps_ptr=path_value->segments; ps_ptr != NULL; ps_ptr=ps_ptr->next ) {
+      struct group **found;
+      if( ps_ptr->group == NULL )
+        continue;
+      found = bsearch(&ps_ptr->group, sorted, as->num_groups, sizeof(struct group *), cmp_group_ptr);
+      find_or_create_tail(scratch, scratch->all_groups[found - sorted], ps_ptr, path_value);
+      ops++;
+    }
+  }
+  *seconds += now_seconds() - start;
+  *allocs  += bench_allocs - allocs_before;
+
+  free(sorted);
+  augsuggest_free(scratch);
+  return(ops);
+}
+
+/* bench()
+ * Repeat the kernel until it has run for MIN_TIME seconds, or for the given number of iterations
+ */
+static void bench(struct augsuggest *as, const char *name, unsigned long (*kernel)(struct augsuggest *)) {
+  unsigned long ops = 0, allocs_before = bench_allocs, run;
+  double start = now_seconds(), elapsed;
+  for( run=0; ; run++ ) {
+    elapsed = now_seconds() - start;
+    if( iterations ? run >= iterations : elapsed >= MIN_TIME )
+      break;
+    ops += kernel(as);
+    if( ops == 0 )
+      break;
+  }
+  report(name, ops, elapsed, bench_allocs - allocs_before);
+}
+
+int main(int argc, char **argv) {
+  augsuggest *as = augsuggest_new();
+  const char *filename = NULL;
+  unsigned long ops = 0, allocs = 0, run;
+  double seconds = 0;
+  int ndx;
+
+  if( as == NULL ) {
+    fprintf(stderr, "Out of memory\n");
+    exit(1);
+  }
+  for( ndx=1; ndx<argc; ndx++ ) {
+    if( strcmp(argv[ndx], "-n") == 0 && ndx+1 < argc ) {
+      iterations = strtoul(argv[++ndx], NULL, 0);
+    } else if( strncmp(argv[ndx], "--", 2) == 0 ) {
+      char *name = strdup(argv[ndx] + 2);
+      char *value = strchr(name, '=');
+      if( value != NULL )
+        *value++ = '\0';
+      if( augsuggest_set_option(as, name, value) != 0 ) {
+        fprintf(stderr, "%s: %s\n", argv[0], augsuggest_error(as));
+        exit(1);
+      }
+      free(name);
+    } else {
+      filename = argv[ndx];
+    }
+  }
+  if( filename == NULL ) {
+    fprintf(stderr, "usage: %s [-n iterations] [--option[=value] ...] file\n", argv[0]);
+    exit(1);
+  }
+  if( augsuggest_load_file(as, filename) != 0 || augsuggest_analyse(as) != 0 ) {
+    fprintf(stderr, "%s: %s\n", argv[0], augsuggest_error(as));
+    exit(1);
+  }
+  if( setjmp(as->fail) ) {
+    fprintf(stderr, "%s: %s\n", argv[0], augsuggest_error(as));
+    exit(1);
+  }
+
+  printf("# %s: %d paths, %u groups, %u values\n", filename, as->num_matched, as->num_groups, as->value_dict_count);
+  printf("%-28s %12s %10s %10s\n", "kernel", "ops", "ns/op", "allocs/op");
+  bench(as, "str_next_pos",         run_str_next_pos);
+  bench(as, "str_simplified_tail",  run_str_simplified_tail);
+  as->use_regexp = 0;
+  bench(as, "value_cmp",            run_value_cmp);
+  as->use_regexp = 8;
+  bench(as, "value_cmp --regexp",   run_value_cmp);
+  bench(as, "quoted_length+quote_into", run_quote);
+  bench(as, "regexp_value",         run_regexp_value);
+  bench(as, "cleanup_filepath",     run_cleanup_filepath);
+  for( run=0; iterations ? run < iterations : seconds < MIN_TIME; run++ ) {
+    unsigned long run_ops = run_find_or_create_tail(as, &seconds, &allocs);
+    ops += run_ops;
+    if( run_ops == 0 )
+      break;
+  }
+  report("find_or_create_tail", ops, seconds, allocs);
+
+  augsuggest_free(as);
+  exit(0);
+}
@@ -0,0 +1,31 @@
+#!/bin/bash
+#
+# microbench.sh - run bench/microbench over each kind of input in the bench corpus
+#
+# usage: bench/microbench.sh [size]      (default: 1000)
+#
+# Environment:
+#   MICROBENCH   microbench binary to run (default bench/microbench)
+#   BENCH_DIR    directory for the corpus (default bench/corpus)
+#   BENCH_ARGS   extra options, eg. "-n 10" or "--regexp=12"
+#
+# The corpus is generated by bench/gencorpus.sh if it does not exist yet
+# Exit status is non-zero if microbench failed for any input
+
+MICROBENCH=${MICROBENCH:-bench/microbench}
+BENCH_DIR=${BENCH_DIR:-bench/corpus}
+BENCH_ARGS=${BENCH_ARGS:-}
+n=${1:-1000}
+
+. bench/kinds.sh
+
+for kind in $KINDS; do
+  [ -f "$BENCH_DIR/$kind.$n" ] || bench/gencorpus.sh "$BENCH_DIR" $n || exit 1
+done
+
+rc=0
+for kind in $KINDS; do
+  $MICROBENCH $(kind_args $kind) $BENCH_ARGS "$BENCH_DIR/$kind.$n" || rc=1
+  echo
+done
+exit $rc
@@ -0,0 +1,55 @@
+#!/bin/bash
+#
+# run.sh - run augsuggest over the bench corpus, and report the time and peak memory for each input
+#
+# usage: bench/run.sh [size ...]      (default: 100 1000 10000)
+#
+# Environment:
+#   AUGSUGGEST   augsuggest binary to run (default ./augsuggest)
+#   BENCH_DIR    directory for the corpus and the generated scripts (default bench/corpus)
+#   BENCH_ARGS   extra augsuggest options, eg. "--pretty --regexp"
+#
+# The corpus is generated by bench/gencorpus.sh if it does not exist yet
+# Times and peak memory are taken from augsuggest --stats
+# Exit status is non-zero if augsuggest failed for any input
+
+AUGSUGGEST=${AUGSUGGEST:-./augsuggest}
+BENCH_DIR=${BENCH_DIR:-bench/corpus}
+BENCH_ARGS=${BENCH_ARGS:-}
+
+if [ $# -gt 0 ]; then
+  sizes="$*"
+else
+  sizes="100 1000 10000"
+fi
+
+. bench/kinds.sh
+
+for n in $sizes; do
+  for kind in $KINDS; do
+    [ -f "$BENCH_DIR/$kind.$n" ] || bench/gencorpus.sh "$BENCH_DIR" $n || exit 1
+  done
+done
+
+rc=0
+printf "%-8s %8s %8s %8s %8s %10s %10s %12s %10s\n" "input" "size" "lines" "paths" "groups" "wall_ms" "cpu_ms" "peak_rss_kb" "out_bytes"
+for kind in $KINDS; do
+  for n in $sizes; do
+    input="$BENCH_DIR/$kind.$n"
+    script="$BENCH_DIR/$kind.$n.augtool"
+    stats="$BENCH_DIR/$kind.$n.stats"
+    if ! $AUGSUGGEST $(kind_args $kind) $BENCH_ARGS --stats "$input" > "$script" 2> "$stats"; then
+      printf "%-8s %8s FAILED, see %s\n" $kind $n "$stats"
+      rc=1
+      continue
+    fi
+    awk -v kind=$kind -v n=$n -v lines=$(wc -l < "$input") -v bytes=$(wc -c < "$script") '
+      $1 == "total"       { wall = $2; cpu = $3 }
+      $1 == "paths"       { paths = $2 }
+      $1 == "groups"      { groups = $2 }
+      $1 == "process_peak_rss_kb" { rss = $2 }
+      END { printf("%-8s %8s %8d %8d %8d %10.1f %10.1f %12d %10d\n", kind, n, lines, paths, groups, wall, cpu, rss, bytes) }
+    ' "$stats"
+  done
+done
+exit $rc
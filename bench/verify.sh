@@ -0,0 +1,51 @@
+#!/bin/bash
+#
+# verify.sh - check that the script generated for each input re-creates it, and is idempotent, with augsuggest --verify
+#
+# usage: bench/verify.sh [size ...]      (default: 100 1000)
+#
+# Environment:
+#   AUGSUGGEST   augsuggest binary to run (default ./augsuggest)
+#   BENCH_DIR    directory for the corpus (default bench/corpus)
+#
+# The test.* files and each input of the bench corpus are verified with each set of options in VARIANTS below
+# Nothing is written to disk, see --verify in README.md
+# Exit status is non-zero if any input failed to verify
+
+AUGSUGGEST=${AUGSUGGEST:-./augsuggest}
+BENCH_DIR=${BENCH_DIR:-bench/corpus}
+VARIANTS=( "" "--pretty --regexp" "--defnode" )   # not --noseq, which cannot create new entries in an empty tree
+
+if [ $# -gt 0 ]; then
+  sizes="$*"
+else
+  sizes="100 1000"
+fi
+
+. bench/kinds.sh
+
+for n in $sizes; do
+  for kind in $KINDS; do
+    [ -f "$BENCH_DIR/$kind.$n" ] || bench/gencorpus.sh "$BENCH_DIR" $n || exit 1
+  done
+done
+
+# verify input args...
+verify() {
+  local input=$1 args
+  shift
+  for args in "${VARIANTS[@]}"; do
+    $AUGSUGGEST --verify "$@" $args "$input" || rc=1
+  done
+}
+
+rc=0
+verify test.hosts       --target=/etc/hosts
+verify test.squid.conf  --target=/etc/squid/squid.conf
+verify test.sudoers     --target=/etc/sudoers
+for n in $sizes; do
+  for kind in $KINDS; do
+    verify "$BENCH_DIR/$kind.$n" $(kind_args $kind)
+  done
+done
+exit $rc
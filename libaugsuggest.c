@@ -0,0 +1,4837 @@
+/* vim: expandtab:softtabstop=2:tabstop=2:shiftwidth=2
+ *
+ * Copyright (C) 2022 George Hansper <george@hansper.id.au>
+ * -----------------------------------------------------------------------
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Author: George Hansper <george@hansper.id.au>
+ * -----------------------------------------------------------------------
+ * This tool produces output similar to the augeas 'print' statement
+ * or aug_print() API function
+ *
+ * Where augeas print may produce a set of paths and values like this:
+ *
+ * /files/some/path/label[1]/tail_a value_1a
+ * /files/some/path/label[1]/tail_b value_1b
+ * /files/some/path/label[2]/tail_a value_2a
+ * /files/some/path/label[2]/tail_b value_2b
+ *
+ * or
+ *
+ * /files/some/path/1/tail_a value_1a
+ * /files/some/path/1/tail_b value_1b
+ * /files/some/path/2/tail_a value_2a
+ * /files/some/path/2/tail_b value_2b
+ *
+ *
+ * This tool replaces the abosolute 'position' (1, 2, 3,..) with a path-expression that matches the position
+ * where the values are used to identify the position
+ *
+ * /files/some/path/label[tail_a = value_1a]/tail_a value_1a
+ * /files/some/path/label[tail_a = value_1a]/tail_b value_1b
+ * /files/some/path/label[tail_a = value_2a]/tail_a value_2a
+ * /files/some/path/label[tail_a = value_2a]/tail_b value_2b
+ *
+ * Terms used within:
+ *
+ * /files/some/path/label[1]/tail_a value_1a
+ * `--------------------' \ `-----' `------'
+ *         `--- head       \    \       `--- value
+ *                          \    `--- tail
+ *                           `-- position
+ *
+ * For more complex paths
+ * /files/some/path/1/segement/label[1]/tail_a value_1a
+ *                    `----------------------'
+ *                             |
+ *                             v
+ *                   /segement/label/tail_a
+ *                   `--------------------'
+ *                             `--- simple_tail
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>        /* for strtoul */
+#include <string.h>
+#include <augeas.h>
+#include <errno.h>
+#include <malloc.h>
+#include <time.h>          /* for clock_gettime() */
+#include <fnmatch.h>
+#include <ctype.h>         /* for isdigit() */
+#include <fcntl.h>         /* for open(), O_EXCL */
+#include <unistd.h>        /* for write(), gettid(), fchown(), fsync() */
+#include <sys/stat.h>      /* for stat(), fchmod() */
+#include <stdint.h>        /* for uint32_t */
+#include <stdarg.h>        /* for fatal() */
+#include <setjmp.h>        /* for fatal() */
+#include <sys/param.h>     /* for MIN() MAX() */
+#include <sys/resource.h>  /* for getrusage() */
+#include "libaugsuggest.h"
+#include "augsuggest.h"
+
+/* USDT static probes, for bpftrace, perf or systemtap, eg.
+ *   bpftrace -e 'usdt:./augsuggest:augsuggest:group_end { printf("%s %d\n", str(arg0), arg1); }'
+ * Each probe is a nop in the code, or nothing at all if <sys/sdt.h> (systemtap-sdt-devel) is not installed
+ */
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define PROBE1(name, a)     DTRACE_PROBE1(augsuggest, name, a)
+#define PROBE2(name, a, b)  DTRACE_PROBE2(augsuggest, name, a, b)
+#endif
+#endif
+#ifndef PROBE1
+#define PROBE1(name, a)     do { } while (0)
+#define PROBE2(name, a, b)  do { } while (0)
+#endif
+
+#define CHECK_OOM(condition, action, arg)         \
+    do {                                          \
+        if (condition) {                          \
+            as->out_of_memory|=1;                 \
+            action(as, arg);                      \
+        }                                         \
+    } while (0)
+
+/* --alloc-stats, count calls allocations of new_bytes (replacing old_bytes) of an alloc_type_t
+ * costs one test when neither --alloc-stats nor --trace is given
+ */
+#define ACCOUNT_ALLOC(type, calls, old_bytes, new_bytes)            \
+    do {                                                            \
+        if (as->count_allocs)                                       \
+            alloc_account(as, type, calls, old_bytes, new_bytes);  \
+    } while (0)
+
+/* --debug, log a message (without a trailing newline) for subsys, if its level is at least level
+ * Each costs one test when --debug is not given, and nothing at all when built with -DNDEBUG
+ */
+#ifndef NDEBUG
+#define LOG(subsys, level, ...)                                  \
+    do {                                                         \
+        if (as->log_level[subsys] >= (level))                    \
+            log_msg(as, subsys, level, __VA_ARGS__);             \
+    } while (0)
+#define LOG_ENABLED(subsys, level)  ( as->log_level[subsys] >= (level) )
+#else
+#define LOG(subsys, level, ...)     do { } while (0)
+#define LOG_ENABLED(subsys, level)  0
+#endif
+
+#define LOG_BUFFER_SIZE   8192   /* log messages are written to stderr once they fill this much */
+#define LOG_DEFAULT_LIMIT 100    /* LOG_ELEMENT messages per subsystem, per phase (and group) */
+
+/* bytes per position of the group arrays grown by grow_position_arrays() */
+#define POSITION_ARRAYS_BYTES ( 3*sizeof(struct tail *) + sizeof(chosen_tail_state_t) + 3*sizeof(unsigned int) )
+
+#define MAX_PRETTY_WIDTH 30
+
+#define APPLY_NODE   "/augsuggest"          /* --apply, scratch tree for aug_text_store() and aug_text_retrieve() */
+#define APPLY_TEXT   APPLY_NODE "/text"
+#define APPLY_TREE   APPLY_NODE "/tree"
+#define APPLY_RESULT APPLY_NODE "/result"
+
+#define BINARY_MAGIC "AUGSUG\x01\n"   /* --format=binary stream header, 8 bytes */
+#define BINARY_NULL  0xffffffff         /* --format=binary length of a null string */
+
+#define VERIFY_INPUT    APPLY_NODE "/verify_input"    /* --verify, the input is kept here while the script is run at files_root */
+#define VERIFY_EMPTY    APPLY_NODE "/verify_empty"    /* ... on an empty tree, parsed from this empty text */
+#define VERIFY_TEXT     APPLY_NODE "/verify_text"     /* ... the text saved from that is parsed again into VERIFY_REPARSED */
+#define VERIFY_REPARSED APPLY_NODE "/verify_reparsed"
+#define VERIFY_AGAIN    APPLY_NODE "/verify_again"    /* ... the text saved after applying the script a second time */
+
+#define DIFF_TEXT    APPLY_NODE "/live_text"  /* --diff, the live target is parsed into DIFF_LIVE */
+#define DIFF_LIVE    APPLY_NODE "/live"
+
+#define OUTPUT_BUFFER_SIZE 65536   /* out_sink is flushed at the end of a line once it holds this much */
+
+#define TIME_LIMIT_CANDIDATES 1024   /* choose_tail() checks --time-limit each time this many candidates have been examined */
+
+/* Estimated relative cost for augeas to evaluate a predicate when the script is applied - see predicate_cost()
+ * These weights are guesses from the form of each predicate, they have not been measured (bench/augapply can measure them)
+ */
+#define COST_STEP         4   /* each step of the tail, eg ipaddr is 1 step, localnet/type is 2 steps */
+#define COST_EQUALS       2   /* tail='value' */
+#define COST_REGEXP      16   /* tail=~regexp('value') - the regexp is compiled on each evaluation */
+#define COST_AND          2   /* first_tail and chosen_tail */
+#define COST_OR_COUNT    12   /* ... or count(tail)=0 - used until the position has been created */
+#define COST_VALUE_CHARS  8   /* one unit per 8 chars of the value being compared */
+
+static const char *phase_names[NUM_PHASES] = {
+  "aug_init", "lens", "aug_load_file", "move_tree", "aug_match", "values", "split_path",
+  "query", "choose_tails", "choose_re_width", "choose_pretty_width", "diff", "output", "apply", "verify"
+};
+
+static const char *log_subsys_names[NUM_LOG_SUBSYS] = {
+  "ingest", "group", "choose", "regexp", "output"
+};
+
+static const char *alloc_type_names[NUM_ALLOC_TYPES] = {
+  "path_segment", "head", "simplified_tail", "group", "position_arrays", "tail",
+  "tail_maps", "tail_stub", "subgroup", "regexp", "rendered", "value"
+};
+
+/* Built-in key_schemas for common lenses */
+static const struct {
+  const char *lens;
+  const char *head;
+  const char *key_tail;
+} builtin_key_schemas[] = {
+  { "Hosts",    "/",     "/ipaddr" },
+  { "Fstab",    "/",     "/file"   },
+  { "Crypttab", "/",     "/target" },
+  { "Sudoers",  "/spec", "/user"   },
+  { NULL,       NULL,    NULL      }
+};
+
+static char *str_next_pos(char *start, char **head_end, unsigned int *pos);
+static char *str_simplified_tail(struct augsuggest *as, char *tail_orig);
+static void add_segment_to_group(struct augsuggest *as, struct path_segment *segment, struct augeas_path_value *);
+static unsigned int quoted_length(const char *, char *);
+static void quote_into(char *, const char *, char);
+static char *regexp_value(struct augsuggest *as, char *, int);
+static char *value_regexp(struct augsuggest *as, struct value_entry *, unsigned int);
+static void alloc_account(struct augsuggest *as, alloc_type_t type, unsigned int calls, size_t old_bytes, size_t new_bytes);
+static void stats_now(struct phase_time *now);
+static const char *augeas_error_text(struct augsuggest *as);
+#ifndef NDEBUG
+static void log_msg(struct augsuggest *as, log_subsys_t subsys, int level, const char *format, ...) __attribute__ ((format (printf, 4, 5)));
+#endif
+
+
+/* ----- errors -----
+ * A library must not exit(), so errors deep inside the analysis jump back to the API function
+ * which was called (see fatal()), and that returns -1, with the message in augsuggest_error()
+ */
+
+/* hold()
+ * Keep an allocation which only lasts for the current API call in as->held, until release()
+ * If fatal() abandons the call first, the allocation is freed there, instead of being lost
+ * Returns ptr
+ */
+static void *hold(struct augsuggest *as, void *ptr) {
+  int ndx;
+  for( ndx=0; ndx<MAX_HELD; ndx++ ) {
+    if( as->held[ndx] == NULL ) {
+      as->held[ndx] = ptr;
+      return(ptr);
+    }
+  }
+  /* not reachable, no function holds more than MAX_HELD at once */
+  abort();
+}
+
+/* release()
+ * Free an allocation kept by hold()
+ */
+static void release(struct augsuggest *as, void *ptr) {
+  int ndx;
+  for( ndx=0; ndx<MAX_HELD; ndx++ ) {
+    if( as->held[ndx] == ptr )
+      as->held[ndx] = NULL;
+  }
+  free(ptr);
+}
+
+static void free_held(struct augsuggest *as) {
+  int ndx;
+  for( ndx=0; ndx<MAX_HELD; ndx++ ) {
+    free(as->held[ndx]);
+    as->held[ndx] = NULL;
+  }
+}
+
+static void set_error_va(struct augsuggest *as, const char *format, va_list ap) {
+  char *msg;
+  if( vasprintf(&msg, format, ap) < 0 )
+    msg = NULL;
+  free(as->error);
+  as->error = msg;
+}
+
+/* set_error()
+ * Keep the message for augsuggest_error(), for errors which the caller returns from itself
+ */
+static void set_error(struct augsuggest *as, const char *format, ...) {
+  va_list ap;
+  va_start(ap, format);
+  set_error_va(as, format, ap);
+  va_end(ap);
+}
+
+/* fatal()
+ * Abandon the current API call - every API function does setjmp(as->fail) before calling anything
+ * which may end up here, and returns -1
+ */
+static void fatal(struct augsuggest *as, const char *format, ...) __attribute__((noreturn, format(printf, 2, 3)));
+static void fatal(struct augsuggest *as, const char *format, ...) {
+  va_list ap;
+  va_start(ap, format);
+  set_error_va(as, format, ap);
+  va_end(ap);
+  as->out_api = 0;   /* in case this was while rendering for aug_set() */
+  as->out_api_unquotable = NULL;
+  free_held(as);
+  longjmp(as->fail, 1);
+}
+
+static void fail_oom(struct augsuggest *as, const char *msg) {
+  if( msg ) {
+    fatal(as, "Out of memory %s", msg);
+  } else {
+    fatal(as, "Out of memory");
+  }
+}
+
+/* ----- --debug -----
+ * Messages are collected in as->log_buf, and written to stderr in blocks, at the end of each phase and by augsuggest_free()
+ * LOG_ELEMENT messages, which come from the inner loops, are limited to log_limit per subsystem for each phase
+ * (each group, for choose and regexp), and the number left out is reported instead
+ */
+
+/* log_flush()
+ * Write the collected messages to stderr
+ */
+static void log_flush(struct augsuggest *as) {
+  if( as->log_len > 0 ) {
+    fwrite(as->log_buf, 1, as->log_len, stderr);
+    as->log_len = 0;
+  }
+}
+
+/* log_phase_end()
+ * Report the LOG_ELEMENT messages left out since the last phase ended, and write everything to stderr
+ */
+static void log_phase_end(struct augsuggest *as) {
+  int subsys;
+  for( subsys=0; subsys<NUM_LOG_SUBSYS; subsys++ ) {
+    if( as->log_count[subsys] > as->log_limit ) {
+      log_flush(as);
+      fprintf(stderr, "%s: ... %u more messages not shown, see --debug=limit:n\n", log_subsys_names[subsys], as->log_count[subsys] - as->log_limit);
+    }
+    as->log_count[subsys] = 0;
+  }
+  log_flush(as);
+}
+
+#ifndef NDEBUG
+/* log_msg()
+ * Add "subsys: message\n" to the log buffer - see LOG()
+ */
+static void log_msg(struct augsuggest *as, log_subsys_t subsys, int level, const char *format, ...) {
+  va_list ap;
+  int prefix_len, msg_len;
+  size_t needed;
+  char *buf;
+  if( level >= LOG_ELEMENT && as->log_count[subsys]++ >= as->log_limit )
+    return;
+  va_start(ap, format);
+  msg_len = vsnprintf(NULL, 0, format, ap);
+  va_end(ap);
+  if( msg_len < 0 )
+    return;
+  prefix_len = strlen(log_subsys_names[subsys]) + 2;
+  needed = prefix_len + msg_len + 2;   /* the newline, and the \0 written by vsnprintf() */
+  if( as->log_len + needed > as->log_size ) {
+    log_flush(as);
+    if( needed > as->log_size ) {
+      size_t new_size = MAX(LOG_BUFFER_SIZE, needed);
+      char *new_buf = realloc(as->log_buf, new_size);
+      if( new_buf == NULL )
+        return;
+      as->log_buf  = new_buf;
+      as->log_size = new_size;
+    }
+  }
+  buf = as->log_buf + as->log_len;
+  sprintf(buf, "%s: ", log_subsys_names[subsys]);
+  va_start(ap, format);
+  vsnprintf(buf + prefix_len, msg_len + 1, format, ap);
+  va_end(ap);
+  buf[prefix_len + msg_len] = '\n';
+  as->log_len += prefix_len + msg_len + 1;
+}
+#endif
+
+/* set_log_levels()
+ * --debug=subsys:level,... where subsys is one of log_subsys_names or all, and level defaults to LOG_DETAIL
+ * limit:n sets the number of LOG_ELEMENT messages per subsystem and phase (0 for no limit)
+ * --debug on its own is all:2
+ */
+static void set_log_levels(struct augsuggest *as, const char *value) {
+  const char *item;
+  int subsys, found;
+  if( value == NULL ) {
+    memset(as->log_level, LOG_DETAIL, sizeof(as->log_level));
+    return;
+  }
+  for( item=value; *item; ) {
+    size_t item_len = strcspn(item, ",");
+    size_t name_len = strcspn(item, ":,");
+    unsigned long level = LOG_DETAIL;
+    if( item[name_len] == ':' )
+      level = strtoul(item + name_len + 1, NULL, 0);
+    if( name_len == strlen("limit") && strncmp(item, "limit", name_len) == 0 ) {
+      as->log_limit = level ? level : UINT_MAX;
+    } else {
+      found = 0;
+      for( subsys=0; subsys<NUM_LOG_SUBSYS; subsys++ ) {
+        if( ( name_len == strlen("all") && strncmp(item, "all", name_len) == 0 )
+         || ( name_len == strlen(log_subsys_names[subsys]) && strncmp(item, log_subsys_names[subsys], name_len) == 0 ) ) {
+          as->log_level[subsys] = MIN(level, LOG_ELEMENT);
+          found = 1;
+        }
+      }
+      if( ! found ) {
+        fatal(as, "unknown --debug subsystem \"%.*s\", expected ingest, group, choose, regexp, output or all", (int) name_len, item);
+      }
+    }
+    item += item_len;
+    if( *item == ',' )
+      item++;
+  }
+}
+
+/* Remove /./ and /../ components from path
+ * because they just don't work with augeas
+ */
+static void cleanup_filepath(char *path) {
+  char *to=path, *from=path;
+  while(*from) {
+    if(*from == '/' ) {
+      if( *(from+1) == '/' ) {
+          /* // skip over 2nd / */
+          from++;
+          continue;
+      } else if( *(from+1) == '.' ) {
+        if( *(from+2) == '/' ) {
+          /* /./ skip 2 spaces */
+          from+=2;
+          continue;
+        } else if ( *(from+2) == '.' && *(from+3) == '/' ) {
+          /* /../ rewind to previous / */
+          from+=3;
+          while( to > path && *(--to) != '/' )
+            ;
+          continue;
+        }
+      }
+    }
+    *to++ = *from++;
+  }
+  *to='\0';
+}
+
+/* find_lens_for_path()
+ * Return the name of the lens (malloc()ed) which applies to filename in /augeas/load, or NULL if none does
+ */
+static char *find_lens_for_path(struct augsuggest *as, char *filename) {
+  char *aug_load_path = NULL;
+  char **matching_lenses;
+  int  num_lenses, result, ndx;
+  char *filename_tail;
+  char *lens;
+  filename_tail = filename;
+  for (char *s1 = filename; *s1; s1++ ) {
+     if ( *s1 == '/' )
+       filename_tail = s1+1;
+  }
+  result = asprintf(&aug_load_path, "/augeas/load/*['%s' =~ glob(incl)]['%s' !~ glob(excl)]['%s' !~ glob(excl)]", filename, filename, filename_tail);
+  CHECK_OOM( result < 0, fail_oom, NULL);
+
+  LOG(LOG_INGEST, LOG_INFO, "path expr: %s", aug_load_path);
+  if( LOG_ENABLED(LOG_INGEST, LOG_ELEMENT) ) {
+    log_flush(as);
+    aug_print(as->aug, stderr, aug_load_path);
+  }
+  num_lenses = aug_match( as->aug, aug_load_path, &matching_lenses);
+  free(aug_load_path);
+  if ( num_lenses <= 0 ) {
+    return(NULL);
+  }
+  lens = strdup(matching_lenses[0] + 13); /* skip over /augeas/load */
+  CHECK_OOM( ! lens, fail_oom, "in find_lens_for_path()");
+
+  if ( num_lenses > 1 ) {
+    /* Should never happen */
+    for( ndx=0; ndx<num_lenses;ndx++) {
+      fprintf(stderr,"Found lens: %s\n", matching_lenses[ndx]);
+    }
+    fprintf(stderr, "Warning: multiple lenses apply to target %s - using %s\n", filename, lens);
+  }
+
+  for( ndx=0; ndx<num_lenses; ndx++ ) {
+    free(matching_lenses[ndx]);
+  }
+  free(matching_lenses);
+  return(lens);
+}
+
+static void move_tree(struct augsuggest *as, char *inputfile, char *target_file) {
+  char *files_inputfile;
+  char *files_targetfile;
+  char *dangling_path;
+  char *aug_rm_path;
+  int  result;
+  int  removed;
+  char *last, *s;
+  result = asprintf(&files_inputfile, "/files%s", inputfile );
+  CHECK_OOM( result < 0, fail_oom, NULL);
+
+  result = asprintf(&files_targetfile, "/files%s", target_file );
+  CHECK_OOM( result < 0, fail_oom, NULL);
+
+  LOG(LOG_INGEST, LOG_INFO, "mv %s %s", files_inputfile, files_targetfile);
+  aug_mv(as->aug, files_inputfile, files_targetfile);
+  if( LOG_ENABLED(LOG_INGEST, LOG_ELEMENT) ) {
+    log_flush(as);
+    aug_print(as->aug, stderr, "/files");
+  }
+  /* After the aug_mv, we're left with the empty parent nodes */
+  dangling_path = files_inputfile;
+  do {
+    /* dirname(prune_path), without copying anything */
+    for( s=last=dangling_path; *s; s++ ) {
+      if( *s == '/')
+        last=s;
+    }
+    *last = '\0';
+
+    result = asprintf(&aug_rm_path, "%s[count(*)=0 and .='']", dangling_path );
+    CHECK_OOM( result < 0, fail_oom, NULL);
+
+    removed = aug_rm(as->aug, aug_rm_path);
+    free(aug_rm_path);
+
+  } while ( removed == 1 );
+
+  free(files_inputfile);
+  free(files_targetfile);
+}
+
+/* ----- split_path() str_next_pos() str_simplified_tail() add_segment_to_group() ----- */
+/* split_path()
+ * Break up a path like this
+ *   /head/label_a[123]/middle/label_b[456]/tail
+ *
+ * into (struct path_segment) segments like this
+ *
+ * head     = "/head/label_a"
+ * segement = "/head/label_a"
+ * position = 123
+ * simplified_tail = "/middle/label_b/tail"
+ *
+ * head     = "/head/label_a[123]/middle/label_b"
+ * segement =                   "/middle/label_b"
+ * position = 456
+ * simplified_tail = "/tail"
+ *
+ * head     = "/head/label_a[123]/middle/label_b[456]/tail"
+ * segement =                   "/tail"
+ * position = UINT_MAX (-1)
+ * simplified_tail = ""
+ *
+ * If label_b is absent, use seq::* or * instead in the simplified tail, head is unaffected
+ */
+static struct path_segment *split_path(struct augsuggest *as, struct augeas_path_value *path_value) {
+  char *path = path_value->path;
+  struct path_segment *first_segment = NULL;
+  struct path_segment *this_segment = NULL;
+  struct path_segment **next_segment = &first_segment;
+  unsigned int position;
+  char *head_end;
+  char *path_seg_start=path;
+  char *path_seg_end;
+
+  while(*path_seg_start) {
+    this_segment = malloc(sizeof(struct path_segment));
+    CHECK_OOM(! this_segment, fail_oom, "split_path() allocating struct path_segment");
+    ACCOUNT_ALLOC(ALLOC_SEGMENT, 1, 0, sizeof(struct path_segment));
+
+    *next_segment  = this_segment;
+    path_seg_end   = str_next_pos(path_seg_start, &head_end, &position);
+    this_segment->head     = strndup(path, (head_end-path));
+    CHECK_OOM(! this_segment->head, fail_oom, "in split_path()");
+    ACCOUNT_ALLOC(ALLOC_HEAD, 1, 0, head_end-path+1);
+    this_segment->segment  = (this_segment->head) + (path_seg_start-path);
+    this_segment->position = position;
+    this_segment->simplified_tail = str_simplified_tail(as, path_seg_end);
+    path_seg_start = path_seg_end;
+    this_segment->next     = NULL;
+    next_segment = &(this_segment->next);
+    if ( position != UINT_MAX ) {
+      add_segment_to_group(as, this_segment, path_value);
+    } else {
+      this_segment->group = NULL;
+    }
+    LOG(LOG_INGEST, LOG_ELEMENT, "split_path() head = '%s', segment = '%s' group = %lx path_seg_start = %s", this_segment->head, this_segment->segment, (long unsigned int) this_segment->group, path_seg_start);
+  }
+  return(first_segment);
+}
+
+/*
+ * str_next_pos() scans a string from (char *)start, and finds the next occurance
+ * of the substring '[123]' or '/123/' where 123 is a decimal number
+ * (int *)pos is set to the value of 123
+ * if [123] is found,
+ *   - head_end points to the character '['
+ *   - returns a  pointer to the character after the ']'
+ * if /123/  or /123\0 is found
+ *   - head_end points to character after the first '/'
+ *   - returns a pointer to the second '/' or '\0'
+ * if none of the above are found
+ *   - head_end points to the terminating '\0'
+ *   - returns a pointer to the terminating '\0' (same as head_end)
+ * ie. look for [123] or /123/ or /123\0, set int pos to 123 or UINT_MAX, set head_end to char before '[' or before 1st digit; return pointer to trailing / or \0
+*/
+static char *str_next_pos(char *start, char **head_end, unsigned int *pos) {
+  char *endptr=NULL;
+  char *s=start;
+  unsigned long lpos;
+  *pos=UINT_MAX;
+  while(*s) {
+    if( *s=='[' && *(s+1) >= '0' && *(s+1) <= '9' ) {
+        lpos = strtoul(s+1, &endptr, 10);
+        *pos = MIN(lpos, UINT_MAX);
+        if ( *endptr == ']' ) {
+          /* success */
+          *head_end = s;
+          return(endptr+1);
+        }
+    } else if ( *s == '/' && *(s+1) >= '0' && *(s+1) <= '9' ) {
+        lpos = strtoul(s+1, &endptr, 10);
+        *pos = MIN(lpos, UINT_MAX);
+        if ( *endptr == '\0' || *endptr == '/' ) {
+          /* success */
+          *head_end = s+1;
+          return(endptr);
+        }
+    }
+    s++;
+  }
+  *head_end=s;
+  return(s);
+}
+
+static char *str_simplified_tail(struct augsuggest *as, char *tail_orig) {
+  int tail_len=0;
+  char *tail;
+  char *from, *to, *scan;
+  char *simple;
+  /* first work out how much space we will need to allocate */
+  tail=tail_orig;
+  while(*tail) {
+    if( *tail == '[' && *(tail+1) >= '0' && *(tail+1) <= '9' ) {
+      /* Look for matching ']' */
+      scan = tail;
+      scan++;
+      while (*scan >= '0' && *scan <= '9')
+        scan++;
+      if(*scan == ']') {
+        tail=scan+1;
+        continue;
+      }
+    } else if ( *tail == '/' && *(tail+1) >= '0' && *(tail+1) <= '9' ) {
+      /* Look for next '/' or '\0' */
+      scan = tail;
+      scan++;
+      while (*scan >= '0' && *scan <= '9')
+        scan++;
+      if(*scan == '/' || *scan == '\0' ) {
+        tail=scan;
+        tail_len += 7; /* allow for /seq::* */
+        continue;
+      }
+    }
+    tail_len++;
+    tail++;
+  }
+  simple = (char *) malloc( sizeof(char) * (tail_len+1));
+  CHECK_OOM( ! simple, fail_oom, "allocating simple_tail in str_simplified_tail()");
+  ACCOUNT_ALLOC(ALLOC_SIMPLE_TAIL, 1, 0, tail_len+1);
+
+  from=tail_orig;
+  to=simple;
+  while(*from) {
+    if( *from == '[' && *(from+1) >= '0' && *(from+1) <= '9' ) {
+      /* skip over  [123] */
+      scan = from;
+      scan++;
+      while (*scan >= '0' && *scan <= '9')
+        scan++;
+      if(*scan == ']') {
+        from=scan+1;
+        continue;
+      }
+    } else if ( *from == '/' && *(from+1) >= '0' && *(from+1) <= '9' ) {
+      /* replace /123 with /seq::*  */
+      scan = from;
+      scan++;
+      while (*scan >= '0' && *scan <= '9')
+        scan++;
+      if(*scan == '/' || *scan == '\0' ) {
+        from=scan;
+        if ( as->noseq ) {
+          strcpy(to,"/*");
+          to += 2;
+        } else {
+          strcpy(to,"/seq::*");
+          to += 7; /* len("/seq::*") */
+        }
+        continue;
+      }
+    }
+    *to++ = *from++; /* copy */
+  }
+  *to='\0';
+  if( *simple != '\0' )
+    LOG(LOG_INGEST, LOG_ELEMENT, "simplified_tail: %s", simple);
+  return(simple);
+}
+
+/* Compare two values (char *), subject to use_regexp
+ * If both pointers are NULL, return 1 (true)
+ * If only one pointer is NULL, return 0 (false)
+ * set *matched to the number of characters in common
+ * return 1 (true) if the strings match, otherwise 0 (false)
+ */
+static int value_cmp(struct augsuggest *as, char *v1, char *v2, unsigned int *matched) {
+  char *s1, *s2;
+  if( v1 == NULL && v2 == NULL ) {
+    *matched = 0;
+    return(1);
+  }
+  if( v1 == NULL || v2 == NULL ) {
+    *matched = 0;
+    return(0);
+  }
+  s1 = v1;
+  s2 = v2;
+  *matched = 0;
+  if( as->use_regexp ) {
+    /* Compare values, allowing for the fact that ']' is replaced with '.' */
+    while( *s1 || *s2 ) {
+      if( *s1 != *s2 ) {
+        if( *s1 =='\0' || *s2 == '\0')
+          return(0);
+        if( *s1 != ']' && *s2 != ']' )
+          return(0);
+      }
+      s1++; s2++; (*matched)++;
+    }
+    return(1);
+  } else {
+    while( *s1 == *s2 ) {
+      if( *s1 == '\0' ) {
+        return(1);
+      }
+      s1++; s2++; (*matched)++;
+    }
+    return(0);
+  }
+  return(1); /* unreachable */
+}
+
+/* Find an existing group with the same 'head'
+ * If no such group exists, create a new one
+ * Update the size of all_groups array if required
+ */
+static struct group *find_or_create_group(struct augsuggest *as, char *head) {
+  unsigned long ndx;
+  struct group **all_groups_realloc;
+  unsigned int num_groups_newsize;
+  struct group *group = NULL;
+  LOG(LOG_GROUP, LOG_ELEMENT, "find_or_create_group(%s)",head);
+  /* Look for an existing group with group->head matching path_seg->head */
+  for(ndx=0; ndx < as->num_groups; ndx++) {
+    if( strcmp(head, as->all_groups[ndx]->head) == 0 ) {
+      group = as->all_groups[ndx];
+      return(group);
+    }
+  }
+  /* Group not found - create a new one */
+  /* First, grow all_groups[] array if required */
+  if ( as->num_groups % 32 == 0 ) {
+      num_groups_newsize = (as->num_groups)/32*32+32;
+      all_groups_realloc = reallocarray(as->all_groups, sizeof(struct group *), num_groups_newsize);
+      CHECK_OOM( ! all_groups_realloc, fail_oom, "in find_or_create_group()");
+      ACCOUNT_ALLOC(ALLOC_GROUP, 1, sizeof(struct group *) * as->num_groups, sizeof(struct group *) * num_groups_newsize);
+      LOG(LOG_GROUP, LOG_DETAIL, "Increased all_groups to %u members (num_groups=%u)", num_groups_newsize, as->num_groups);
+
+      as->all_groups=all_groups_realloc;
+  }
+  /* Create new group */
+  group = malloc(sizeof(struct group));
+  CHECK_OOM( ! group, fail_oom, "allocating struct group in find_or_create_group()");
+  ACCOUNT_ALLOC(ALLOC_GROUP, 1, 0, sizeof(struct group));
+
+  as->all_groups[as->num_groups++] = group;
+  group->head = head;
+  group->all_tails = NULL;
+  group->tail_stats = NULL;
+  group->key = NULL;
+  group->schema_head = NULL;
+  group->position_array_size = 0;
+  group->tails_at_position = NULL;
+  group->chosen_tail = NULL;
+  group->chosen_tail_state = NULL;
+  group->first_tail = NULL;
+  group->position_array_size = 0;
+  group->max_position = 0;
+  group->candidates_examined = 0;
+  group->choose_time = 0;
+  group->re_width_time = 0;
+  group->subgroups = NULL;  /* subgroups are only created if we need to use our 3rd preference */
+  group->subgroup_position = NULL;
+  /* for --query */
+  group->selected = NULL;
+  /* for --pretty */
+  group->pretty_width_ct = NULL;
+  /* for output_segment() */
+  group->rendered = NULL;
+  group->rendered_len = NULL;
+  group->rendered_state = NULL;
+  /* for --apply */
+  group->initial_state = NULL;
+  /* for --regexp */
+  group->re_width_ct = NULL;
+  group->re_width_ft = NULL;
+
+  return(group);
+}
+
+/* Find a matching tail+value within group->all_tails linked list
+ * If no such tail exists, append a new (struct tail) list item
+ * Return the tail found, or the new tail
+ */
+static struct tail *find_or_create_tail(struct augsuggest *as, struct group *group, struct path_segment *path_seg, struct augeas_path_value *path_value) {
+  /* Scan for a matching simplified tail+value in group->all_tails */
+  struct tail *tail;
+  struct tail *found_tail_value=NULL;
+  struct tail *found_tail=NULL;
+  struct tail **all_tails_end;
+  struct tail_stats **tail_stats_end;
+  unsigned int tail_found_this_pos=1;
+  unsigned int match_length;
+  LOG(LOG_INGEST, LOG_ELEMENT, "find_or_create_tail(tail=%s, position=%u) value=%s",path_seg->simplified_tail, path_seg->position,path_value->value);
+  all_tails_end =&(group->all_tails);
+  found_tail_value=NULL;
+  for( tail = group->all_tails; tail != NULL; tail=tail->next ) {
+    if( strcmp(path_seg->simplified_tail, tail->simple_tail) == 0 ) {
+      /* found matching simple_tail - increment counters */
+      tail->tail_found_map[path_seg->position]++;
+      tail_found_this_pos = tail->tail_found_map[path_seg->position];
+      if ( value_cmp(as, tail->value, path_value->value, &match_length ) ) {
+        /* matching tail+value found, increment tail_value_found */
+        tail->tail_value_found_map[path_seg->position]++;
+        tail->tail_value_found++;
+        found_tail_value=tail;
+      }
+      found_tail=tail;
+    }
+    all_tails_end=&tail->next;
+  }
+  if ( found_tail_value == NULL ) {
+    /* matching tail+value not found, create a new one */
+    tail = malloc(sizeof(struct tail));
+    CHECK_OOM( ! tail, fail_oom, "in find_or_create_tail()");
+
+    tail->tail_found_map       = reallocarray(NULL, sizeof(unsigned int), group->position_array_size);
+    CHECK_OOM( ! tail->tail_found_map, fail_oom, "in find_or_create_tail()");
+
+    tail->tail_value_found_map = reallocarray(NULL, sizeof(unsigned int), group->position_array_size);
+    CHECK_OOM( ! tail->tail_value_found_map, fail_oom, "in find_or_create_tail()");
+    ACCOUNT_ALLOC(ALLOC_TAIL,      1, 0, sizeof(struct tail));
+    ACCOUNT_ALLOC(ALLOC_TAIL_MAPS, 2, 0, 2 * sizeof(unsigned int) * group->position_array_size);
+
+
+    for(unsigned int i=0; i<group->position_array_size; i++) {
+      tail->tail_found_map[i]=0;
+      tail->tail_value_found_map[i]=0;
+    }
+
+    if ( found_tail ) {
+      for( unsigned int ndx=0; ndx<=group->max_position; ndx++ ) {
+        tail->tail_found_map[ndx] = found_tail->tail_found_map[ndx];
+      }
+    }
+    if ( found_tail ) {
+      tail->stats = found_tail->stats;
+    } else {
+      /* first appearance of this simple_tail in the group */
+      tail->stats = malloc(sizeof(struct tail_stats));
+      CHECK_OOM( ! tail->stats, fail_oom, "in find_or_create_tail()");
+      ACCOUNT_ALLOC(ALLOC_TAIL, 1, 0, sizeof(struct tail_stats));
+
+      tail->stats->simple_tail = path_seg->simplified_tail;
+      tail->stats->tail        = tail;
+      tail->stats->coverage    = 0;
+      tail->stats->next        = NULL;
+      for( tail_stats_end=&(group->tail_stats); *tail_stats_end != NULL; tail_stats_end=&(*tail_stats_end)->next )
+        ;
+      *tail_stats_end = tail->stats;
+    }
+    tail->tail_found_map[path_seg->position]=tail_found_this_pos;
+    tail->tail_value_found_map[path_seg->position]=1;
+    tail->tail_value_found = 1;
+    tail->simple_tail = path_seg->simplified_tail;
+    tail->value       = path_value->value;
+    tail->dict        = path_value->dict;
+    tail->next        = NULL;
+    *all_tails_end = tail;
+  } else {
+    tail = found_tail_value;
+  }
+  /* count the positions where this simple_tail appears exactly once as they change, for is_key_candidate() */
+  if( tail_found_this_pos == 1 ) {
+    tail->stats->coverage++;
+  } else if( tail_found_this_pos == 2 ) {
+    tail->stats->coverage--;
+  }
+  return(tail);
+}
+
+/* Append a (struct tail_stub) to the linked list group->tails_at_position[position] */
+static void append_tail_stub(struct augsuggest *as, struct group *group, struct tail *tail, unsigned int position) {
+  struct tail_stub **tail_stub_pp;
+  LOG(LOG_INGEST, LOG_ELEMENT, "append_tail_stub() position=%u size=%u tail=%s value=%s", position, group->position_array_size, tail->simple_tail, tail->value);
+
+  for( tail_stub_pp=&(group->tails_at_position[position]); *tail_stub_pp != NULL; tail_stub_pp=&(*tail_stub_pp)->next )
+    ;
+  *tail_stub_pp = malloc(sizeof(struct tail_stub));
+  CHECK_OOM( ! *tail_stub_pp, fail_oom, "in append_tail_stub()");
+  ACCOUNT_ALLOC(ALLOC_STUB, 1, 0, sizeof(struct tail_stub));
+
+  (*tail_stub_pp)->tail     = tail;
+  (*tail_stub_pp)->next     = NULL;
+}
+
+/* Grow memory structures within the group record and associated tail records
+ * to accommodate additional positions
+ */
+static void grow_position_arrays(struct augsuggest *as, struct group *group, unsigned int new_max_position) {
+  struct tail_stub **tails_at_position_realloc;
+  struct tail      **chosen_tail_realloc;
+  struct tail_stub **first_tail_realloc;
+  unsigned int      *chosen_tail_state_realloc;
+  unsigned int      *pretty_width_ct_realloc;
+  unsigned int      *re_width_ct_realloc;
+  unsigned int      *re_width_ft_realloc;
+  unsigned int       ndx;
+  if( new_max_position != UINT_MAX && new_max_position >= group->position_array_size ) {
+    unsigned int old_size = group->position_array_size;
+    unsigned int new_size = (new_max_position+1) / 8 * 8 + 8;
+    LOG(LOG_INGEST, LOG_DETAIL, "--- grow_position_arrays() group=%s position = %u ), new_size = %u", group->head, new_max_position, new_size);
+
+    /* Grow arrays within struct group */
+    tails_at_position_realloc = reallocarray(group->tails_at_position,  sizeof(struct tail_stub *),  new_size);
+    chosen_tail_realloc       = reallocarray(group->chosen_tail,        sizeof(struct tail *),       new_size);
+    first_tail_realloc        = reallocarray(group->first_tail,         sizeof(struct tail_stub *),  new_size);
+    chosen_tail_state_realloc = reallocarray(group->chosen_tail_state,  sizeof(chosen_tail_state_t), new_size);
+    pretty_width_ct_realloc   = reallocarray(group->pretty_width_ct,    sizeof(unsigned int),        new_size);
+    re_width_ct_realloc       = reallocarray(group->re_width_ct,        sizeof(unsigned int),        new_size);
+    re_width_ft_realloc       = reallocarray(group->re_width_ft,        sizeof(unsigned int),        new_size);
+    CHECK_OOM( ! tails_at_position_realloc || ! chosen_tail_realloc || ! chosen_tail_state_realloc ||
+               ! pretty_width_ct_realloc   || ! re_width_ct_realloc || ! re_width_ft_realloc       ||
+               ! first_tail_realloc, fail_oom, "in grow_position_arrays()");
+    ACCOUNT_ALLOC(ALLOC_POSITION_ARRAYS, 7, POSITION_ARRAYS_BYTES * old_size, POSITION_ARRAYS_BYTES * new_size);
+
+    /* initialize array entries between old size to new_size */
+    for( ndx=old_size; ndx < new_size; ndx++) {
+      tails_at_position_realloc[ndx]=NULL;
+      chosen_tail_realloc[ndx]=NULL;
+      first_tail_realloc[ndx]=NULL;
+      chosen_tail_state_realloc[ndx] = NOT_DONE;
+      pretty_width_ct_realloc[ndx] = 0;
+      re_width_ct_realloc[ndx] = 0;
+      re_width_ft_realloc[ndx] = 0;
+    }
+    group->tails_at_position = tails_at_position_realloc;
+    group->chosen_tail = chosen_tail_realloc;
+    group->first_tail  = first_tail_realloc;
+    group->chosen_tail_state = chosen_tail_state_realloc;
+    group->pretty_width_ct = pretty_width_ct_realloc;
+    group->re_width_ct = re_width_ct_realloc;
+    group->re_width_ft = re_width_ft_realloc;
+    /* Grow arrays in all_tails */
+    struct tail *tail;
+    for( tail = group->all_tails; tail != NULL; tail=tail->next ) {
+      unsigned int *tail_found_map_realloc;
+      unsigned int *tail_value_found_map_realloc;
+      tail_found_map_realloc       = reallocarray(tail->tail_found_map,       sizeof(unsigned int), new_size);
+      tail_value_found_map_realloc = reallocarray(tail->tail_value_found_map, sizeof(unsigned int), new_size);
+      CHECK_OOM( ! tail_found_map_realloc || ! tail_value_found_map_realloc, fail_oom, "in grow_position_arrays()");
+      ACCOUNT_ALLOC(ALLOC_TAIL_MAPS, 2, 2 * sizeof(unsigned int) * old_size, 2 * sizeof(unsigned int) * new_size);
+
+      /* initialize array entries between old size to new_size */
+      for( ndx=old_size; ndx < new_size; ndx++) {
+        tail_found_map_realloc[ndx]=0;
+        tail_value_found_map_realloc[ndx]=0;
+      }
+      tail->tail_found_map = tail_found_map_realloc;
+      tail->tail_value_found_map = tail_value_found_map_realloc;
+    }
+    group->position_array_size = new_size;
+  }
+}
+
+static void add_segment_to_group(struct augsuggest *as, struct path_segment *path_seg, struct augeas_path_value *path_value) {
+  struct group *group = NULL;
+  struct tail  *tail;
+  group = find_or_create_group(as, path_seg->head);
+
+  /* group is our new or matching group for this segment->head */
+  path_seg->group = group;
+  if( path_seg->position != UINT_MAX && path_seg->position > group->max_position ) {
+    group->max_position = path_seg->position;
+    if( group->max_position >= group->position_array_size ) {
+      /* grow arrays in group */
+      grow_position_arrays(as, group, group->max_position);
+    }
+  }
+  tail = find_or_create_tail(as, group, path_seg, path_value);
+
+  /* Append a tail_stub record to the linked list @ group->tails_at_position[position] */
+  append_tail_stub(as, group, tail, path_seg->position);
+}
+
+/* find_or_create_subgroup()
+ * This is called from choose_tail(), and is only used if we need to go to our 3rd Preference
+ */
+static struct subgroup *find_or_create_subgroup(struct augsuggest *as, struct group *group, struct tail *first_tail) {
+  struct subgroup *subgroup_ptr;
+  struct subgroup **sg_pp;
+  LOG(LOG_GROUP, LOG_DETAIL, "# find_or_create_subgroup() first_tail@%lx =%s = %s", (long unsigned int) first_tail, first_tail->simple_tail, first_tail->value);
+  for( sg_pp=&(group->subgroups); *sg_pp != NULL; sg_pp=&(*sg_pp)->next) {
+    if( (*sg_pp)->first_tail == first_tail ) {
+      return(*sg_pp);
+    }
+  }
+  /* Create and populate subgroup */
+  subgroup_ptr = (struct subgroup *) malloc( sizeof(struct subgroup));
+  CHECK_OOM( ! subgroup_ptr, fail_oom, "in find_or_create_subgroup()");
+
+  subgroup_ptr->next=NULL;
+  subgroup_ptr->first_tail=first_tail;
+  /* positions are 1..max_position, +1 for the terminating 0=end-of-list */
+  subgroup_ptr->matching_positions = malloc( (group->max_position+1) * sizeof( unsigned int ));
+  CHECK_OOM( ! subgroup_ptr->matching_positions, fail_oom, "in find_or_create_subgroup()");
+  ACCOUNT_ALLOC(ALLOC_SUBGROUP, 2, 0, sizeof(struct subgroup) + (group->max_position+1) * sizeof(unsigned int));
+
+  /* malloc group->subgroup_position if not already done */
+  if ( ! group->subgroup_position ) {
+    group->subgroup_position = malloc( (group->max_position+1) * sizeof( unsigned int ));
+    CHECK_OOM( ! group->subgroup_position, fail_oom, "in find_or_create_subgroup()");
+    ACCOUNT_ALLOC(ALLOC_SUBGROUP, 1, 0, (group->max_position+1) * sizeof(unsigned int));
+
+  }
+  *sg_pp = subgroup_ptr; /* Append new subgroup record to list */
+  /* populate matching_positions */
+  unsigned int pos_ndx;
+  unsigned int ndx = 0;
+  for(pos_ndx=1; pos_ndx <= group->max_position; pos_ndx++ ){
+    /* save the position if this tail+value exists for this position - not necessarily the first tail, we need to check all tails at this position */
+    struct tail_stub *tail_stub_ptr;
+    for( tail_stub_ptr = group->tails_at_position[pos_ndx]; tail_stub_ptr != NULL; tail_stub_ptr=tail_stub_ptr->next ) {
+      if( tail_stub_ptr->tail == first_tail ) {
+        subgroup_ptr->matching_positions[ndx++] = pos_ndx;
+        if( first_tail == group->first_tail[pos_ndx]->tail ) {
+          /* If first_fail is also the first_tail for this position, update subgroup_position[] */
+          group->subgroup_position[pos_ndx]=ndx; /* yes, we want ndx+1, because matching_positions index starts at 0, where as the fallback position starts at 1 */
+          LOG(LOG_GROUP, LOG_ELEMENT, "find_or_create_subgroup() [%u] %lx ->%u", pos_ndx, (long unsigned int) group->first_tail[pos_ndx]->tail, ndx);
+        } else {
+          LOG(LOG_GROUP, LOG_ELEMENT, "find_or_create_subgroup() [%u] %lx", pos_ndx, (long unsigned int) group->first_tail[pos_ndx]->tail);
+        }
+        break;
+      }
+    }
+  }
+  LOG(LOG_GROUP, LOG_DETAIL, "find_or_create_subgroup() first_tail@%lx =%s = %s - %u positions", (long unsigned int) first_tail, first_tail->simple_tail, first_tail->value, ndx);
+  subgroup_ptr->matching_positions[ndx] = 0;  /* 0 = end of list */
+  return(subgroup_ptr);
+}
+
+/* str_ischild()
+ * compare 2 strings which are  of the form simple_tail
+ * return true(1)  if parent == /path and child == /path/tail
+ * return false(0) if child == /pathother or child == /pat or anything else
+ */
+static int str_ischild(char *parent, char *child) {
+  while( *parent ) {
+    if( *parent != *child ) {
+      return(0);
+    }
+    parent++;
+    child++;
+  }
+  if( *child == '/' ) {
+    return(1);
+  } else {
+    return(0);
+  }
+}
+
+/* Find the first tail in the linked-list that is not NULL, or has no child nodes
+   * eg for paths starting with /head/123/... ignore the entry:
+   *    /head/123 (null)
+   * and any further paths like this
+   *   head/123/tail (null)
+   *   head/123/tail/child (null)
+   * stop when we encounter a value, or find a tail that has no child nodes,
+   * if the next tail is eg
+   *   head/123/tail2
+   * then head/123/tail/child is significant, and that becomes the first_tail
+   */
+static struct tail_stub *find_first_tail(struct tail_stub *tail_stub_ptr) {
+  if( tail_stub_ptr == NULL )
+    return(NULL);
+  for( ; tail_stub_ptr->next != NULL; tail_stub_ptr=tail_stub_ptr->next ) {
+    if ( tail_stub_ptr->tail->value != NULL && tail_stub_ptr->tail->value[0] != '\0' ) {
+      break;
+    }
+    if( ! str_ischild( tail_stub_ptr->tail->simple_tail, tail_stub_ptr->next->tail->simple_tail) ) {
+      /* the next tail is not a child-node of this tail */
+      break;
+    }
+  }
+  return(tail_stub_ptr);
+}
+
+/* ----- key_schemas ----- */
+/* Return the lens name without any leading @ or trailing .lns, eg. @Hosts and Hosts.lns are both Hosts */
+static char *schema_lens_name(struct augsuggest *as, const char *name) {
+  char *result;
+  size_t len;
+  if( *name == '@' )
+    name++;
+  len = strlen(name);
+  if( len > 4 && strcmp(name+len-4, ".lns") == 0 )
+    len -= 4;
+  result = strndup(name, len);
+  CHECK_OOM( ! result, fail_oom, "in schema_lens_name()");
+  return(result);
+}
+
+static struct key_schema *add_key_schema(struct augsuggest *as, char *schema_lens_str, char *head, char *key_tail, int builtin) {
+  struct key_schema *schema;
+  struct key_schema **schema_pp;
+  schema = malloc(sizeof(struct key_schema));
+  CHECK_OOM( ! schema, fail_oom, "in add_key_schema()");
+
+  schema->lens     = schema_lens_str;
+  schema->head     = head;
+  schema->key_tail = key_tail;
+  schema->builtin  = builtin;
+  schema->next     = NULL;
+  /* Append, so that entries from the --schema file are found before the built-in defaults */
+  for( schema_pp=&as->key_schemas; *schema_pp != NULL; schema_pp=&(*schema_pp)->next )
+    ;
+  *schema_pp = schema;
+  return(schema);
+}
+
+/* Read the --schema file, if it exists, then append the built-in defaults
+ * Each line is: lens<TAB>head<TAB>key_tail
+ * Lines starting with # and empty lines are ignored
+ */
+static void read_key_schemas(struct augsuggest *as) {
+  FILE *fp;
+  char *line = NULL;
+  size_t line_size = 0;
+  int ndx;
+  if( as->schema_file != NULL && (fp = fopen(as->schema_file, "r")) != NULL ) {
+    while( getline(&line, &line_size, fp) > 0 ) {
+      char *schema_lens_str, *head, *key_tail;
+      line[strcspn(line, "\r\n")] = '\0';
+      if( *line == '#' || *line == '\0' )
+        continue;
+      /* strsep(), not strtok(), as the key tail is "" for a key which is the value of the entry itself */
+      key_tail        = line;
+      schema_lens_str = strsep(&key_tail, "\t");
+      head            = strsep(&key_tail, "\t");
+      if( key_tail == NULL || *schema_lens_str == '\0' || *head == '\0' ) {
+        fprintf(stderr, "Warning: %s: ignoring invalid line: %s\n", as->schema_file, line);
+        continue;
+      }
+      head     = strdup(head);
+      key_tail = strdup(key_tail);
+      CHECK_OOM( ! head || ! key_tail, fail_oom, "in read_key_schemas()");
+
+      add_key_schema(as, schema_lens_name(as, schema_lens_str), head, key_tail, 0);
+    }
+    free(line);
+    fclose(fp);
+  } else if ( as->schema_file != NULL && errno != ENOENT ) {
+    fprintf(stderr, "Warning: could not read %s: %s\n", as->schema_file, strerror(errno));
+  }
+  for( ndx=0; builtin_key_schemas[ndx].lens != NULL; ndx++ ) {
+    add_key_schema( as, (char *) builtin_key_schemas[ndx].lens, (char *) builtin_key_schemas[ndx].head, (char *) builtin_key_schemas[ndx].key_tail, 1);
+  }
+}
+
+/* create_temp_file()
+ * Create a new file filename.xxxxxx in the same directory as filename, so that it can be renamed over it
+ * O_EXCL and O_NOFOLLOW never open an existing file or follow a symlink, another name is tried if one exists
+ * The kernel applies the umask to mode - the umask is never changed here, it is shared by all threads
+ * Return the open file descriptor and the name in *tmp_file_p (to be freed), or -1 with errno set
+ */
+static int create_temp_file(struct augsuggest *as, const char *filename, mode_t mode, char **tmp_file_p) {
+  struct timespec now;
+  uint64_t seed;
+  int fd, tries, result;
+  clock_gettime(CLOCK_REALTIME, &now);
+  seed = (uint64_t) now.tv_nsec ^ ((uint64_t) getpid() << 32) ^ (uint64_t) (uintptr_t) as;
+  for( tries=0; tries<100; tries++ ) {
+    seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    result = asprintf(tmp_file_p, "%s.%06x", filename, (unsigned int) (seed >> 40));
+    CHECK_OOM( result < 0, fail_oom, NULL);
+    fd = open(*tmp_file_p, O_WRONLY|O_CREAT|O_EXCL|O_NOFOLLOW|O_CLOEXEC, mode);
+    if( fd >= 0 || errno != EEXIST )
+      return(fd);
+    free(*tmp_file_p);
+  }
+  *tmp_file_p = NULL;
+  return(-1);
+}
+
+/* Write the --schema file, adding the keys found by find_group_key() in this run
+ * The file is written to a temporary file from create_temp_file() first, and renamed into place
+ * keeping the mode of an existing file. It is left alone if no key has changed
+ */
+static void write_key_schemas(struct augsuggest *as) {
+  struct key_schema *schema;
+  char *tmp_file;
+  FILE *fp;
+  struct stat st;
+  unsigned int ndx;
+  int fd, exists, changed = 0;
+  if( as->schema_file == NULL || as->schema_lens == NULL )
+    return;
+  for( ndx=0; ndx<as->num_groups; ndx++ ) {
+    struct group *group = as->all_groups[ndx];
+    if( group->key == NULL || group->schema_head == NULL )
+      continue;
+    for( schema=as->key_schemas; schema != NULL; schema=schema->next ) {
+      if( strcmp(schema->lens, as->schema_lens) == 0 && fnmatch(schema->head, group->schema_head, 0) == 0 )
+        break;
+    }
+    if( schema != NULL && strcmp(schema->key_tail, group->key->simple_tail) == 0 ) {
+      /* already known */
+      continue;
+    }
+    if( schema != NULL && ! schema->builtin && strcmp(schema->head, group->schema_head) == 0 ) {
+      /* the key for this group has changed */
+      free(schema->key_tail);
+      schema->key_tail = strdup(group->key->simple_tail);
+      CHECK_OOM( ! schema->key_tail, fail_oom, "in write_key_schemas()");
+      changed = 1;
+    } else {
+      char *lens_str = strdup(as->schema_lens);
+      char *head     = strdup(group->schema_head);
+      char *key_tail = strdup(group->key->simple_tail);
+      CHECK_OOM( ! lens_str || ! head || ! key_tail, fail_oom, "in write_key_schemas()");
+      add_key_schema(as, lens_str, head, key_tail, 0);
+      changed = 1;
+    }
+  }
+  if( ! changed )
+    return;
+  exists = stat(as->schema_file, &st) == 0;
+  fd = create_temp_file(as, as->schema_file, exists ? 0600 : 0666, &tmp_file);
+  if( fd < 0 ) {
+    fprintf(stderr, "Warning: could not create a temporary file for %s: %s\n", as->schema_file, strerror(errno));
+    free(tmp_file);
+    return;
+  }
+  fp = fdopen(fd, "w");
+  if( fp == NULL || ( exists && fchmod(fd, st.st_mode & 07777) != 0 ) ) {
+    fprintf(stderr, "Warning: could not write %s: %s\n", tmp_file, strerror(errno));
+    if( fp != NULL )
+      fclose(fp);
+    else
+      close(fd);
+    unlink(tmp_file);
+    free(tmp_file);
+    return;
+  }
+  fprintf(fp, "# augsuggest key schema: lens<TAB>group head<TAB>key tail\n");
+  for( schema=as->key_schemas; schema != NULL; schema=schema->next ) {
+    if( ! schema->builtin )
+      fprintf(fp, "%s\t%s\t%s\n", schema->lens, schema->head, schema->key_tail);
+  }
+  if( fclose(fp) != 0 || rename(tmp_file, as->schema_file) != 0 ) {
+    fprintf(stderr, "Warning: could not write %s: %s\n", as->schema_file, strerror(errno));
+    unlink(tmp_file);
+  }
+  free(tmp_file);
+}
+
+/* Look up the known key for this group, return the matching tail_stats or NULL */
+static struct tail_stats *find_schema_key(struct augsuggest *as, struct group *group) {
+  struct key_schema *schema;
+  struct tail_stats *stats;
+  size_t root_len;
+  if( as->schema_lens == NULL )
+    return(NULL);
+  if( group->schema_head == NULL ) {
+    root_len = strlen(as->files_root);
+    if( strncmp(group->head, as->files_root, root_len) == 0 ) {
+      group->schema_head = str_simplified_tail(as, group->head + root_len);
+    } else {
+      group->schema_head = str_simplified_tail(as, group->head);
+    }
+  }
+  for( schema=as->key_schemas; schema != NULL; schema=schema->next ) {
+    if( strcmp(schema->lens, as->schema_lens) == 0 && fnmatch(schema->head, group->schema_head, 0) == 0 )
+      break;
+  }
+  if( schema == NULL )
+    return(NULL);
+  for( stats = group->tail_stats; stats != NULL; stats=stats->next ) {
+    if( strcmp(stats->simple_tail, schema->key_tail) == 0 )
+      return(stats);
+  }
+  return(NULL);
+}
+
+/* tail_depth()
+ * The number of steps in the tail, eg ipaddr is 1 step, localnet/type is 2 steps
+ */
+static unsigned int tail_depth(struct tail *tail) {
+  unsigned int depth = 0;
+  char *s;
+  for( s=tail->simple_tail; *s; s++ ) {
+    if( *s == '/' )
+      depth++;
+  }
+  return(MAX(depth, 1));  /* "" is written as . */
+}
+
+/* tail_cost()
+ * Estimate the cost of evaluating the predicate [tail='value'] or [tail=~regexp('value')]
+ * based on the depth of the tail, the operator, and the length of the value
+ * With --regexp, only the part of the value kept by choose_re_width() is compared, see find_re_widths()
+ */
+static unsigned int tail_cost(struct augsuggest *as, struct tail *tail) {
+  unsigned int cost;
+  size_t value_len;
+  cost = COST_STEP * tail_depth(tail);
+  if( tail->value != NULL ) {
+    /* [tail] alone is only an existence test, there is no value to compare */
+    value_len = strlen(tail->value);
+    if( as->use_regexp ) {
+      cost += COST_REGEXP;
+      value_len = MIN(value_len, MAX(tail->re_width, (unsigned int) as->use_regexp));
+    } else {
+      cost += COST_EQUALS;
+    }
+    cost += value_len / COST_VALUE_CHARS;
+  }
+  return(cost);
+}
+
+/* predicate_cost()
+ * Estimate the cost of the predicate that output_segment() will write for chosen_tail, given chosen_tail_state
+ */
+static unsigned int predicate_cost(struct augsuggest *as, struct tail *first_tail, struct tail *chosen_tail, chosen_tail_state_t chosen_tail_state) {
+  switch( chosen_tail_state ) {
+    case FIRST_TAIL:
+      return(tail_cost(as, chosen_tail));
+    case CHOSEN_TAIL_START:
+      /* [chosen_tail='value' or count(chosen_tail)=0] */
+      return(tail_cost(as, chosen_tail) + COST_OR_COUNT + COST_STEP * tail_depth(chosen_tail));
+    case CHOSEN_TAIL_PLUS_FIRST_TAIL_START:
+      /* [first_tail='value' and ( chosen_tail='value' or count(chosen_tail)=0 )] */
+      return(tail_cost(as, first_tail) + COST_AND + predicate_cost(as, first_tail, chosen_tail, CHOSEN_TAIL_START));
+    default:
+      return(UINT_MAX);
+  }
+}
+
+/* key_cost()
+ * Estimate the cost of the predicates if this simple_tail is the group key: the value_cost of its unique values,
+ * plus " or count()=0" where it is not the first tail, see predicate_cost()
+ */
+static unsigned long key_cost(struct group *group, struct tail_stats *stats) {
+  return( stats->value_cost + (unsigned long) (group->max_position - MIN(stats->first_tail_positions, group->max_position))
+                              * (COST_OR_COUNT + COST_STEP * tail_depth(stats->tail)) );
+}
+
+/* is_key_candidate()
+ * A key candidate must appear exactly once at every position, with a unique value at more than half of them
+ */
+static int is_key_candidate(struct group *group, struct tail_stats *stats) {
+  return( stats->coverage == group->max_position && stats->unique_positions * 2 > group->max_position );
+}
+
+/* find_group_key()
+ * Collect statistics for each simple_tail across the whole group, and look for a simple_tail
+ * that can be used as a key for every position, eg ipaddr in /etc/hosts - see is_key_candidate()
+ * If key_schemas has a known key for this group that is still a candidate, use that without searching
+ * Otherwise prefer the candidate with the most unique values, then the cheapest, see key_cost()
+ * Positions where the key value is not unique fall back to the preferences in choose_tail()
+ */
+static void find_group_key(struct augsuggest *as, struct group *group) {
+  struct tail       *tail;
+  struct tail_stats *stats;
+  unsigned int       position;
+
+  group->key = NULL;
+  for( stats = group->tail_stats; stats != NULL; stats=stats->next ) {
+    stats->occurrences = 0;
+    stats->distinct_values = 0;
+    stats->duplicates = 0;
+    stats->unique_positions = 0;
+    stats->first_tail_positions = 0;
+    stats->value_cost = 0;
+    stats->present_positions = UINT_MAX;  /* not yet known, see tail_at_all_positions() */
+  }
+  for( tail = group->all_tails; tail != NULL; tail=tail->next ) {
+    tail->stats->occurrences += tail->tail_value_found;
+    tail->stats->distinct_values++;
+    if( tail->tail_value_found == 1 ) {
+      tail->stats->unique_positions++;
+      tail->stats->value_cost += tail_cost(as, tail);
+    } else {
+      tail->stats->duplicates++;
+    }
+  }
+  stats = find_schema_key(as, group);
+  if( stats != NULL && is_key_candidate(group, stats) ) {
+    group->key = stats;
+    LOG(LOG_GROUP, LOG_DETAIL, "# find_group_key() %s known key=%s unique=%u/%u", group->head, group->key->simple_tail, group->key->unique_positions, group->max_position);
+    return;
+  }
+  for( position=1; position<=group->max_position; position++ ) {
+    if( group->first_tail[position] != NULL ) {
+      group->first_tail[position]->tail->stats->first_tail_positions++;
+    }
+  }
+  for( stats = group->tail_stats; stats != NULL; stats=stats->next ) {
+    if( ! is_key_candidate(group, stats) ) {
+      continue;
+    }
+    if( group->key == NULL
+      || stats->unique_positions > group->key->unique_positions
+      || ( stats->unique_positions == group->key->unique_positions && key_cost(group, stats) < key_cost(group, group->key) )
+      ) {
+      group->key = stats;
+    }
+  }
+  if( group->key )
+    LOG(LOG_GROUP, LOG_DETAIL, "# find_group_key() %s key=%s unique=%u/%u first_tail=%u cost=%lu", group->head, group->key->simple_tail, group->key->unique_positions, group->max_position, group->key->first_tail_positions, key_cost(group, group->key));
+}
+
+/* tail_at_all_positions()
+ * return true(1) if this simple_tail exists at every position within the group
+ * The result is the same for all tails with the same simple_tail, so it is remembered in tail->stats
+ */
+static int tail_at_all_positions(struct group *group, struct tail *tail) {
+  struct tail_stats *stats = tail->stats;
+  unsigned int ndx;
+  if( stats->present_positions == UINT_MAX ) {
+    stats->present_positions = 0;
+    if( stats->occurrences >= group->max_position ) {
+      /* otherwise there are not enough occurrences to cover every position */
+      for( ndx=1; ndx <= group->max_position; ndx++ ) {
+        if( tail->tail_found_map[ndx] != 0 ) {
+          stats->present_positions++;
+        }
+      }
+    }
+  }
+  return(stats->present_positions == group->max_position);
+}
+
+/* Return the time since augsuggest_new() created this context, in seconds */
+static double elapsed_time(struct augsuggest *as) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return( (now.tv_sec - as->start_time.tv_sec) + (now.tv_nsec - as->start_time.tv_nsec) / 1e9 );
+}
+
+/* candidate_time_limit()
+ * Count a candidate examined by choose_tail(), and return true(1) if --time-limit has been exceeded
+ * The clock is only read every TIME_LIMIT_CANDIDATES candidates
+ */
+static int candidate_time_limit(struct augsuggest *as, struct group *group) {
+  group->candidates_examined++;
+  return( as->time_limit > 0 && group->candidates_examined % TIME_LIMIT_CANDIDATES == 0
+          && elapsed_time(as) > as->time_limit );
+}
+
+static struct tail *choose_tail(struct augsuggest *as, struct group *group, unsigned int position ) {
+  struct tail_stub *first_tail_stub;
+  struct tail_stub *tail_stub_ptr;
+  struct tail *best_tail = NULL;
+  chosen_tail_state_t best_state = NOT_DONE;
+  unsigned int best_cost = UINT_MAX;
+  unsigned int ndx;
+  int out_of_time = 0;   /* --time-limit exceeded, stop examining candidates */
+
+  if( group->tails_at_position[position] == NULL ) {
+    /* first_tail_stub == NULL
+     * this does not happen, because every position gets at least one tail of ""
+     * eg, even if the value is NULL.
+     *   /head/1   (null)
+     *   ...simple_tail ""
+     *   ...value NULL
+     * paths without a position ( /head/tail ) are not added to any group
+     * We can't do anything with this, use seq::* or [*] only (no value) */
+    fprintf(stderr,"# choose_tail() %s[%u] first_tail_stub is NULL (internal error)\n", group->head, position);
+    group->chosen_tail_state[position] = NO_CHILD_NODES;
+    return(NULL);
+  }
+
+  first_tail_stub = group->first_tail[position];
+  LOG(LOG_CHOOSE, LOG_DETAIL, "# choose_tail() %s[%u] first_tail = %s", group->head, position, first_tail_stub->tail->simple_tail);
+
+  /* Group key - if the key value is unique at this position, use that, so all positions share the same predicate
+   * A key which is not the first tail is written with " or count()=0" until the position is complete (CHOSEN_TAIL_START),
+   * so it is only used if a unique first tail would not be cheaper, see predicate_cost()
+   */
+  if( group->key != NULL ) {
+    for( tail_stub_ptr=first_tail_stub; tail_stub_ptr!=NULL; tail_stub_ptr=tail_stub_ptr->next) {
+      if( tail_stub_ptr->tail->stats == group->key ) {
+        break;
+      }
+    }
+    if( tail_stub_ptr != NULL && tail_stub_ptr->tail->tail_value_found == 1 ) {
+      if( tail_stub_ptr == first_tail_stub ) {
+        LOG(LOG_CHOOSE, LOG_DETAIL, "# choose_tail() [%u] group key is the first tail: %s=%s", position, tail_stub_ptr->tail->simple_tail, tail_stub_ptr->tail->value);
+        group->chosen_tail_state[position] = FIRST_TAIL;
+        return(tail_stub_ptr->tail);
+      }
+      if( first_tail_stub->tail->tail_value_found != 1
+        || predicate_cost(as, first_tail_stub->tail, tail_stub_ptr->tail, CHOSEN_TAIL_START)
+             <= predicate_cost(as, first_tail_stub->tail, first_tail_stub->tail, FIRST_TAIL) ) {
+        LOG(LOG_CHOOSE, LOG_DETAIL, "# choose_tail() [%u] group key: %s=%s", position, tail_stub_ptr->tail->simple_tail, tail_stub_ptr->tail->value);
+        group->chosen_tail_state[position] = CHOSEN_TAIL_START;
+        return(tail_stub_ptr->tail);
+      }
+      LOG(LOG_CHOOSE, LOG_DETAIL, "# choose_tail() [%u] group key %s=%s costs more than the unique first tail", position, tail_stub_ptr->tail->simple_tail, tail_stub_ptr->tail->value);
+    }
+  }
+
+  /* First preference - if the first-tail+value is unique, use that
+   * unless the Second preference finds a cheaper predicate, see predicate_cost()
+   */
+  if( first_tail_stub->tail->tail_value_found == 1 ) {
+    best_tail  = first_tail_stub->tail;
+    best_state = FIRST_TAIL;
+    best_cost  = predicate_cost(as, first_tail_stub->tail, best_tail, best_state);
+    LOG(LOG_CHOOSE, LOG_DETAIL, "# choose_tail() [%u] 1st preference: using first tail %s[%u] %s=%s cost=%u",position, group->head,position,first_tail_stub->tail->simple_tail, first_tail_stub->tail->value, best_cost);
+  }
+
+  /* Second preference - find a unique tail+value that has only one value for this position and has the tail existing for all other positions
+   * If there is more than one, choose the cheapest
+   */
+  for( tail_stub_ptr=first_tail_stub; tail_stub_ptr!=NULL; tail_stub_ptr=tail_stub_ptr->next) {
+    if( tail_stub_ptr->tail == best_tail ) {
+      continue;
+    }
+    if( tail_stub_ptr->tail->tail_value_found == 1 ) { /* tail_stub_ptr->tail->value can be NULL, just needs to be unique */
+      int found=1;
+      unsigned int cost;
+      if( candidate_time_limit(as, group) ) {
+        /* keep the best so far, choose_all_tails() degrades the remaining positions */
+        out_of_time = 1;
+        break;
+      }
+      cost = predicate_cost(as, first_tail_stub->tail, tail_stub_ptr->tail, CHOSEN_TAIL_START);
+      if( cost >= best_cost ) {
+        continue;
+      }
+      if ( ! tail_at_all_positions(group, tail_stub_ptr->tail) ) {
+        /* tail does not exist for every position within this group */
+        found=0;
+      }
+      LOG(LOG_CHOOSE, LOG_ELEMENT, "# choose_tail() [%u] found %s at all positions=%d", position, tail_stub_ptr->tail->simple_tail, found);
+      if ( found ) {
+        /* This works only if chosen_tail->simple_tail is the first appearance of simple_tail at this position */
+        struct tail_stub *tail_check_ptr;
+        for( tail_check_ptr=first_tail_stub; tail_check_ptr != tail_stub_ptr; tail_check_ptr=tail_check_ptr->next) {
+          if( strcmp(tail_check_ptr->tail->simple_tail, tail_stub_ptr->tail->simple_tail ) == 0 ) {
+            found=0;
+          }
+        }
+      }
+      if ( found ) {
+        LOG(LOG_CHOOSE, LOG_DETAIL, "# choose_tail() [%u] 2nd preference first_tail: %s=%s found: %s = %s cost=%u", position, first_tail_stub->tail->simple_tail, first_tail_stub->tail->value,tail_stub_ptr->tail->simple_tail, tail_stub_ptr->tail->value, cost);
+        best_tail  = tail_stub_ptr->tail;
+        best_state = CHOSEN_TAIL_START;
+        best_cost  = cost;
+      }
+    } /* if ... tail_value_found == 1 */
+  }
+  if( best_tail != NULL ) {
+    group->chosen_tail_state[position] = best_state;
+    return(best_tail);
+  }
+  if( out_of_time ) {
+    /* skip the 3rd preference (and find_or_create_subgroup()), choose_all_tails() degrades this position and the rest */
+    group->chosen_tail_state[position] = NOT_DONE;
+    return(NULL);
+  }
+
+  /* Third preference - first tail is not unique but could make a unique combination with another tail */
+  struct subgroup *subgroup_ptr = find_or_create_subgroup(as, group, first_tail_stub->tail);
+  LOG(LOG_CHOOSE, LOG_DETAIL, "# choose_tail() [%u] 3rd preference, first_tail=%s %s", position, first_tail_stub->tail->simple_tail, first_tail_stub->tail->value);
+  for( tail_stub_ptr=first_tail_stub->next; tail_stub_ptr!=NULL; tail_stub_ptr=tail_stub_ptr->next) {
+    /* for each tail at this position (other than the first) */
+    /* Find a tail at this position where:
+     * a) tail+value is unique within this subgroup
+     * b) tail exists at all positions within this subgroup
+     */
+    int found=1;
+    unsigned int cost;
+    if( candidate_time_limit(as, group) ) {
+      break;
+    }
+    cost = predicate_cost(as, first_tail_stub->tail, tail_stub_ptr->tail, CHOSEN_TAIL_PLUS_FIRST_TAIL_START);
+    if( cost >= best_cost ) {
+      /* we already have a cheaper candidate */
+      continue;
+    }
+    LOG(LOG_CHOOSE, LOG_ELEMENT, "choose_tail() [%u] 3rd preference: first_tail: %s=%s, candidate: %s=%s", position, first_tail_stub->tail->simple_tail, first_tail_stub->tail->value, tail_stub_ptr->tail->simple_tail, tail_stub_ptr->tail->value);
+    for(ndx=0; subgroup_ptr->matching_positions[ndx] != 0; ndx++ ) {
+      int pos=subgroup_ptr->matching_positions[ndx];
+      if ( pos == position ) continue;
+      if( tail_stub_ptr->tail->tail_value_found_map[pos] != 0 ) {
+        /* tail+value is not unique within this subgroup */
+        found=0;
+        break;
+      }
+      if( tail_stub_ptr->tail->tail_found_map[pos] == 0 ) {
+        /* tail does not exist for every position within this subgroup */
+        found=0;
+        break;
+      }
+    }
+    if ( found ) {
+      /* This works only if chosen_tail->simple_tail is the first appearance of simple_tail at this position */
+      struct tail_stub *tail_check_ptr;
+      for( tail_check_ptr=first_tail_stub; tail_check_ptr != tail_stub_ptr; tail_check_ptr=tail_check_ptr->next) {
+        if( strcmp(tail_check_ptr->tail->simple_tail, tail_stub_ptr->tail->simple_tail ) == 0 ) {
+          found=0;
+        }
+      }
+    }
+    if ( found ) {
+      LOG(LOG_CHOOSE, LOG_ELEMENT, "choose_tail() [%u] 3rd preference: first_tail: %s=%s, candidate: %s=%s cost=%u", position, first_tail_stub->tail->simple_tail, first_tail_stub->tail->value, tail_stub_ptr->tail->simple_tail, tail_stub_ptr->tail->value, cost);
+      best_tail = tail_stub_ptr->tail;
+      best_cost = cost;
+    }
+  }
+  if( best_tail != NULL ) {
+    group->chosen_tail_state[position] = CHOSEN_TAIL_PLUS_FIRST_TAIL_START;
+    return(best_tail);
+  }
+  /* Fourth preference (fallback) - use first_tail PLUS the position with the subgroup */
+  LOG(LOG_CHOOSE, LOG_DETAIL, "choose_tail() 4th preference: first_tail: %s=%s, position=%u", first_tail_stub->tail->simple_tail, first_tail_stub->tail->value, position);
+  group->chosen_tail_state[position] = FIRST_TAIL_PLUS_POSITION;
+  return(first_tail_stub->tail);
+}
+
+/* simple_tail_expr()
+ * given a simple_tail of the form "/path" or ""
+ * return "path" or "."
+ */
+static const char *simple_tail_expr(char *simple_tail) {
+  if( *simple_tail == '/' ) {
+    /* usual case - .../123/... or /label[123]/... */
+    return(simple_tail+1);
+  } else if ( *simple_tail == '\0' ) {
+    /* path ending in /123 or /label[123] */
+    return(".");
+  } else {
+    /* unreachabe ? */
+    return(simple_tail);
+  }
+}
+
+/* ----- output sink -----
+ * The generated script is assembled in out_sink.buf by the out_*() functions below
+ * and written out in large blocks, instead of with many small printf() calls
+ */
+
+/* out_flush()
+ * Write out everything in the buffer, to the writer callback if there is one, else to fd
+ * An in-memory sink (fd < 0) keeps everything in the buffer
+ */
+static void out_flush(struct augsuggest *as) {
+  size_t done = 0;
+  ssize_t result;
+  if( as->out_sink.writer != NULL ) {
+    if( as->out_sink.len > 0 && as->out_sink.writer(as->out_sink.writer_data, as->out_sink.buf, as->out_sink.len) < 0 )
+      fatal(as, "Error writing output");
+    as->out_sink.len = 0;
+    return;
+  }
+  if( as->out_sink.fd < 0 )
+    return;
+  while( done < as->out_sink.len ) {
+    result = write(as->out_sink.fd, as->out_sink.buf + done, as->out_sink.len - done);
+    if( result < 0 ) {
+      if( errno == EINTR )
+        continue;
+      fatal(as, "Error writing output: %s", strerror(errno));
+    }
+    done += result;
+  }
+  as->out_sink.len = 0;
+}
+
+/* out_reserve()
+ * Make room for at least len more bytes in the buffer
+ * Return a pointer to the end of the data in the buffer
+ */
+static char *out_reserve(struct augsuggest *as, size_t len) {
+  if( as->out_sink.len + len > as->out_sink.size ) {
+    size_t new_size = as->out_sink.size ? as->out_sink.size : OUTPUT_BUFFER_SIZE;
+    char *new_buf;
+    while( as->out_sink.len + len > new_size )
+      new_size *= 2;
+    new_buf = realloc(as->out_sink.buf, new_size);
+    CHECK_OOM( ! new_buf, fail_oom, "in out_reserve()");
+    as->out_sink.buf  = new_buf;
+    as->out_sink.size = new_size;
+  }
+  return(as->out_sink.buf + as->out_sink.len);
+}
+
+static void out_write(struct augsuggest *as, const char *str, size_t len) {
+  memcpy(out_reserve(as, len), str, len);
+  as->out_sink.len += len;
+}
+
+static void out_str(struct augsuggest *as, const char *str) {
+  out_write(as, str, strlen(str));
+}
+
+static void out_char(struct augsuggest *as, char c) {
+  *out_reserve(as, 1) = c;
+  as->out_sink.len++;
+}
+
+/* out_pad()
+ * Write spaces to pad a field of len chars out to width chars
+ */
+static void out_pad(struct augsuggest *as, unsigned int len, int width) {
+  if( width > 0 && len < (unsigned int) width ) {
+    memset(out_reserve(as, width - len), ' ', width - len);
+    as->out_sink.len += width - len;
+  }
+}
+
+/* out_padded()
+ * Write str, left-justified in a field of width chars - same as printf("%*s", -width, str)
+ */
+static void out_padded(struct augsuggest *as, const char *str, int width) {
+  size_t len = strlen(str);
+  out_write(as, str, len);
+  out_pad(as, len, width);
+}
+
+static void out_uint(struct augsuggest *as, unsigned int n) {
+  char digits[16], *d = digits + sizeof(digits);
+  do {
+    *--d = '0' + n % 10;
+    n /= 10;
+  } while( n );
+  out_write(as, d, digits + sizeof(digits) - d);
+}
+
+/* out_quoted()
+ * Write the value quoted and escaped (see quoted_length()), left-justified in a field of width chars
+ * The quoted value is written directly into the buffer, without making a copy
+ */
+static void out_quoted(struct augsuggest *as, const char *value, int width) {
+  char quote;
+  unsigned int len = quoted_length(value, &quote);
+  quote_into(out_reserve(as, len), value, quote);
+  as->out_sink.len += len;
+  out_pad(as, len, width);
+}
+
+/* out_api_quoted()
+ * Write the value quoted for aug_set() and aug_match() - pathx literals have no escapes,
+ * so the value is written as it is, between the quote character chosen by quoted_length()
+ * A value containing both ' and " can not be written at all, it is kept in out_api_unquotable for take_rendered()
+ */
+static void out_api_quoted(struct augsuggest *as, const char *value) {
+  char quote;
+  quoted_length(value, &quote);
+  if( strchr(value, '\'') != NULL && strchr(value, '"') != NULL && as->out_api_unquotable == NULL ) {
+    as->out_api_unquotable = value;
+  }
+  out_char(as, quote);
+  out_str(as, value);
+  out_char(as, quote);
+}
+
+/* out_api_unescaped()
+ * Write a quoted string which was escaped for augtool (see quote_into() and regexp_value()) as augtool would pass it
+ * to aug_set(): \\ \' \" \t and \n are replaced by the character itself, \[ and \] are kept as they are
+ */
+static void out_api_unescaped(struct augsuggest *as, const char *str) {
+  for( ; *str; str++ ) {
+    if( *str == '\\' && str[1] != '\0' && str[1] != '[' && str[1] != ']' ) {
+      str++;
+      out_char(as, *str == 't' ? '\t' : *str == 'n' ? '\n' : *str);
+    } else {
+      out_char(as, *str);
+    }
+  }
+}
+
+/* out_end_record()
+ * Flush the buffer if it is full enough
+ * The buffer is only flushed at the end of a line or record
+ */
+static void out_end_record(struct augsuggest *as) {
+  if( as->out_sink.len >= OUTPUT_BUFFER_SIZE )
+    out_flush(as);
+}
+
+/* out_end_line()
+ * Write a newline, and flush the buffer if it is full enough
+ */
+static void out_end_line(struct augsuggest *as) {
+  out_char(as, '\n');
+  out_end_record(as);
+}
+
+/* out_compare()
+ * Write "tail='value'" or "tail=~regexp('value')" for this tail, with the value padded to width
+ * A tail with no value is written as "tail" (ie. the node exists)
+ * With as->out_api, the value is written for aug_set() and aug_match() instead of for augtool, and is not padded
+ */
+static void out_compare(struct augsuggest *as, struct tail *tail, int width) {
+  out_str(as, simple_tail_expr(tail->simple_tail));
+  if ( tail->value == NULL ) {
+    return;
+  } else if ( as->use_regexp ) {
+    out_str(as, "=~regexp(");
+    if( as->out_api )
+      out_api_unescaped(as, tail->value_re);
+    else
+      out_padded(as, tail->value_re, width);
+    out_char(as, ')');
+  } else {
+    out_char(as, '=');
+    if( as->out_api )
+      out_api_quoted(as, tail->value);
+    else
+      out_quoted(as, tail->value, width);
+  }
+}
+
+/* out_or_count()
+ * Write " or count(tail)=0"
+ */
+static void out_or_count(struct augsuggest *as, struct tail *tail) {
+  out_str(as, " or count(");
+  out_str(as, simple_tail_expr(tail->simple_tail));
+  out_str(as, ")=0");
+}
+
+/* out_segment_label()
+ * Write the segment, followed by * or seq::* for a sequential position
+ * Return the last char of the segment
+ */
+static char out_segment_label(struct augsuggest *as, struct path_segment *ps_ptr) {
+  char *last_c, *str;
+  last_c=ps_ptr->segment;
+  for(str=ps_ptr->segment; *str; last_c=str++)  /* find end of string */
+    ;
+  out_write(as, ps_ptr->segment, str - ps_ptr->segment);
+  if(*last_c=='/') {
+    /* sequential position .../123 */
+    if ( as->noseq )
+      out_char(as, '*');
+    else
+      out_str(as, "seq::*");
+  }
+  /* else label with a position .../label[123], or no position ... /last */
+  return(*last_c);
+}
+
+/* render_state()
+ * The *_START states are rendered in the same way as the *_DONE states
+ * Return the state to render for this chosen_tail_state
+ */
+static chosen_tail_state_t render_state(chosen_tail_state_t chosen_tail_state) {
+  switch( chosen_tail_state ) {
+    case CHOSEN_TAIL_START:
+      return(CHOSEN_TAIL_DONE);
+    case CHOSEN_TAIL_PLUS_FIRST_TAIL_START:
+      return(CHOSEN_TAIL_PLUS_FIRST_TAIL_DONE);
+    default:
+      return(chosen_tail_state);
+  }
+}
+
+/* render_segment()
+ * Write out the path-segment, up to and including the [ expr ] (if required)
+ * for this group position, rendered as for chosen_tail_state
+ */
+static void render_segment(struct augsuggest *as, struct path_segment *ps_ptr, chosen_tail_state_t chosen_tail_state) {
+  char last_c;
+  struct group *group = ps_ptr->group;
+  unsigned int position = ps_ptr->position;
+  struct tail *chosen_tail = group->chosen_tail[position];
+  struct tail_stub *first_tail = group->first_tail[position];
+  int width = group->pretty_width_ct[position];
+
+  last_c = out_segment_label(as, ps_ptr);
+
+  LOG(LOG_OUTPUT, LOG_ELEMENT, "   render_segment() head=%s, simple_tail=%s chosen_tail=%s chosen_tail_state=%d",ps_ptr->head, ps_ptr->simplified_tail, chosen_tail->simple_tail, chosen_tail_state);
+
+  switch( chosen_tail_state ) {
+    case FIRST_TAIL:
+    case CHOSEN_TAIL_DONE:
+    case FIRST_TAIL_PLUS_POSITION:
+      out_char(as, '[');
+      out_compare(as, chosen_tail, width);
+      out_char(as, ']');
+      if ( chosen_tail_state == FIRST_TAIL_PLUS_POSITION ) {
+        /* no unique tail+value - duplicate or overlapping positions */
+        out_char(as, '[');
+        out_uint(as, group->subgroup_position[position]);
+        out_char(as, ']');
+      }
+      break;
+    case CHOSEN_TAIL_WIP:
+      /* chosen_tail->value == NULL is theoretically possible - how to test? */
+      out_char(as, '[');
+      out_compare(as, chosen_tail, width);
+      out_or_count(as, chosen_tail);
+      out_char(as, ']');
+      break;
+    case CHOSEN_TAIL_PLUS_FIRST_TAIL_DONE:
+      /* first_tail->tail->value == NULL - test with /etc/sudoers */
+      out_char(as, '[');
+      out_compare(as, first_tail->tail, width);
+      out_str(as, " and ");
+      out_compare(as, chosen_tail, 0);
+      out_char(as, ']');
+      break;
+    case CHOSEN_TAIL_PLUS_FIRST_TAIL_WIP:
+      out_char(as, '[');
+      out_compare(as, first_tail->tail, width);
+      out_str(as, " and ( ");
+      out_compare(as, chosen_tail, 0);
+      out_or_count(as, chosen_tail);
+      out_str( as, first_tail->tail->value == NULL ? " )]" : " ) ]" );
+      break;
+    case NO_CHILD_NODES:
+      if(last_c!='/') {
+        out_str(as, "[*]"); /* /head/label with no child nodes */
+      }
+      break;
+    default:
+      /* unreachable */
+      out_str(as, "[ ");
+      out_compare(as, chosen_tail, 0);
+      out_str(as, " ]");
+  }
+}
+
+/* Write out the path-segment, up to and including the [ expr ] (if required)
+ * then move this group position on to its next chosen_tail_state
+ * All paths under the same group position share the same rendered text, so it is kept in
+ * group->rendered[position], and only rendered again when the chosen_tail_state changes
+ */
+static void output_segment(struct augsuggest *as, struct path_segment *ps_ptr, struct augeas_path_value *path_value_seg) {
+  struct group *group;
+  struct tail *chosen_tail;
+  unsigned int position;
+  chosen_tail_state_t     chosen_tail_state;
+
+  group = ps_ptr->group;
+  if( group == NULL ) {
+    /* last segment .../last_tail No position, nothing else to print */
+    out_segment_label(as, ps_ptr);
+    return;
+  }
+
+  /* apply "chosen_tail" criteria here */
+  position = ps_ptr->position;
+  chosen_tail = group->chosen_tail[position];
+  if( chosen_tail == NULL ) {
+    /* This should not happen */
+    fprintf(stderr,"chosen_tail==NULL ???\n");
+  }
+  chosen_tail_state = group->chosen_tail_state[position];
+
+  if( group->rendered == NULL ) {
+    group->rendered       = calloc(group->position_array_size, sizeof(char *));
+    group->rendered_len   = calloc(group->position_array_size, sizeof(unsigned int));
+    group->rendered_state = calloc(group->position_array_size, sizeof(chosen_tail_state_t));
+    CHECK_OOM( ! group->rendered || ! group->rendered_len || ! group->rendered_state, fail_oom, "in output_segment()");
+    ACCOUNT_ALLOC(ALLOC_RENDERED, 3, 0, (sizeof(char *) + sizeof(unsigned int) + sizeof(chosen_tail_state_t)) * group->position_array_size);
+  }
+  if( as->out_api ) {
+    /* rendered[] holds the augtool form */
+    render_segment(as, ps_ptr, render_state(chosen_tail_state));
+  } else if( group->rendered[position] != NULL && group->rendered_state[position] == render_state(chosen_tail_state) ) {
+    out_write(as, group->rendered[position], group->rendered_len[position]);
+  } else {
+    size_t start = as->out_sink.len;
+    render_segment(as, ps_ptr, render_state(chosen_tail_state));
+    if( group->rendered[position] != NULL )
+      ACCOUNT_ALLOC(ALLOC_RENDERED, 0, group->rendered_len[position], 0);
+    free(group->rendered[position]);
+    group->rendered_len[position]   = as->out_sink.len - start;
+    group->rendered[position]       = malloc(group->rendered_len[position]);
+    CHECK_OOM( ! group->rendered[position], fail_oom, "in output_segment()");
+    ACCOUNT_ALLOC(ALLOC_RENDERED, 1, 0, group->rendered_len[position]);
+    memcpy(group->rendered[position], as->out_sink.buf + start, group->rendered_len[position]);
+    group->rendered_state[position] = render_state(chosen_tail_state);
+  }
+
+  switch( chosen_tail_state ) {
+    case CHOSEN_TAIL_START:
+      group->chosen_tail_state[position] = CHOSEN_TAIL_WIP;
+      break;
+    case CHOSEN_TAIL_WIP:
+      if ( strcmp(chosen_tail->simple_tail, ps_ptr->simplified_tail) == 0 && chosen_tail->dict == path_value_seg->dict ) {
+        group->chosen_tail_state[position] = CHOSEN_TAIL_DONE;
+      }
+      break;
+    case CHOSEN_TAIL_PLUS_FIRST_TAIL_START:
+      group->chosen_tail_state[position] = CHOSEN_TAIL_PLUS_FIRST_TAIL_WIP;
+      break;
+    case CHOSEN_TAIL_PLUS_FIRST_TAIL_WIP:
+      if ( strcmp(chosen_tail->simple_tail, ps_ptr->simplified_tail) == 0 && chosen_tail->dict == path_value_seg->dict ) {
+        group->chosen_tail_state[position] = CHOSEN_TAIL_PLUS_FIRST_TAIL_DONE;
+      }
+      break;
+    default:
+  }
+}
+
+/* Write out the set-command for this path
+ * If use_node is true, the first segment has already been defined with defnode, and $node is used instead
+ */
+static void output_path(struct augsuggest *as, struct augeas_path_value *path_value_seg, int use_node) {
+  struct path_segment *ps_ptr = path_value_seg->segments;
+  out_str(as, "set ");
+  if( use_node ) {
+    out_str(as, "$" AUGSUGGEST_DEFNODE_VAR);
+    ps_ptr = ps_ptr->next;
+  }
+  for( ; ps_ptr != NULL; ps_ptr=ps_ptr->next) {
+    output_segment(as, ps_ptr, path_value_seg);
+  }
+  if( path_value_seg->value != NULL ) {
+    out_char(as, ' ');
+    out_quoted(as, path_value_seg->value, 0);
+  }
+  out_end_line(as);
+}
+
+/* ----- --format=ndjson|binary ----- */
+
+static const char *chosen_tail_state_name(chosen_tail_state_t chosen_tail_state) {
+  switch( chosen_tail_state ) {
+    case NOT_DONE:                          return("NOT_DONE");
+    case FIRST_TAIL:                        return("FIRST_TAIL");
+    case CHOSEN_TAIL_START:                 return("CHOSEN_TAIL_START");
+    case CHOSEN_TAIL_WIP:                   return("CHOSEN_TAIL_WIP");
+    case CHOSEN_TAIL_DONE:                  return("CHOSEN_TAIL_DONE");
+    case CHOSEN_TAIL_PLUS_FIRST_TAIL_START: return("CHOSEN_TAIL_PLUS_FIRST_TAIL_START");
+    case CHOSEN_TAIL_PLUS_FIRST_TAIL_WIP:   return("CHOSEN_TAIL_PLUS_FIRST_TAIL_WIP");
+    case CHOSEN_TAIL_PLUS_FIRST_TAIL_DONE:  return("CHOSEN_TAIL_PLUS_FIRST_TAIL_DONE");
+    case FIRST_TAIL_PLUS_POSITION:          return("FIRST_TAIL_PLUS_POSITION");
+    case NO_CHILD_NODES:                    return("NO_CHILD_NODES");
+    default:                                return("UNKNOWN");
+  }
+}
+
+/* out_json_string()
+ * Write str as a JSON string, or null if str is NULL
+ */
+static void out_json_string(struct augsuggest *as, const char *str, size_t len) {
+  static const char hex[] = "0123456789abcdef";
+  const char *s, *plain;
+  if( str == NULL ) {
+    out_str(as, "null");
+    return;
+  }
+  out_char(as, '"');
+  for( s = plain = str; s < str + len; s++ ) {
+    unsigned char c = *s;
+    if( c >= 0x20 && c != '"' && c != '\\' )
+      continue;
+    out_write(as, plain, s - plain);
+    plain = s + 1;
+    out_char(as, '\\');
+    switch( c ) {
+      case '"':  out_char(as, '"');  break;
+      case '\\': out_char(as, '\\'); break;
+      case '\n': out_char(as, 'n');  break;
+      case '\t': out_char(as, 't');  break;
+      default:
+        out_str(as, "u00");
+        out_char(as, hex[c >> 4]);
+        out_char(as, hex[c & 0xf]);
+    }
+  }
+  out_write(as, plain, s - plain);
+  out_char(as, '"');
+}
+
+/* out_u32()
+ * Write n as 4 bytes, little-endian
+ */
+static void out_u32(struct augsuggest *as, uint32_t n) {
+  char *p = out_reserve(as, 4);
+  p[0] = n & 0xff;
+  p[1] = (n >> 8) & 0xff;
+  p[2] = (n >> 16) & 0xff;
+  p[3] = (n >> 24) & 0xff;
+  as->out_sink.len += 4;
+}
+
+/* out_binary_string()
+ * Write the length of str (or 0xffffffff if str is NULL) followed by str
+ */
+static void out_binary_string(struct augsuggest *as, const char *str, size_t len) {
+  if( str == NULL ) {
+    out_u32(as, BINARY_NULL);
+    return;
+  }
+  out_u32(as, len);
+  out_write(as, str, len);
+}
+
+/* out_field()
+ * Write a string field of the current record, in the --format in use
+ * For ndjson, name is the key, and sep is written before it (, or {)
+ */
+static void out_field(struct augsuggest *as, char sep, const char *name, const char *str, size_t len) {
+  if( as->output_format == FORMAT_BINARY ) {
+    out_binary_string(as, str, len);
+  } else {
+    out_char(as, sep);
+    out_json_string(as, name, strlen(name));
+    out_char(as, ':');
+    out_json_string(as, str, len);
+  }
+}
+
+static void out_uint_field(struct augsuggest *as, const char *name, unsigned int n) {
+  if( as->output_format == FORMAT_BINARY ) {
+    out_u32(as, n);
+  } else {
+    out_char(as, ',');
+    out_json_string(as, name, strlen(name));
+    out_char(as, ':');
+    out_uint(as, n);
+  }
+}
+
+/* out_tail_fields()
+ * Write the tail and value (or nulls) for a record segment
+ */
+static void out_tail_fields(struct augsuggest *as, const char *tail_name, const char *value_name, struct tail *tail) {
+  const char *expr = tail ? simple_tail_expr(tail->simple_tail) : NULL;
+  if( as->output_format != FORMAT_BINARY && tail == NULL )
+    return;
+  out_field(as, ',', tail_name, expr, expr ? strlen(expr) : 0);
+  out_field(as, ',', value_name, tail ? tail->value : NULL, tail && tail->value ? strlen(tail->value) : 0);
+}
+
+/* output_record()
+ * Write one --format=ndjson or --format=binary record for the set-command for this path
+ * The path is rendered by output_segment() as usual, then split back into its segments
+ *
+ * ndjson, one line per record:
+ *   {"path":"...","value":"..."|null,"segments":[{"label":"...","predicate":"...","state":"FIRST_TAIL",
+ *     "tail":"...","tail_value":"...","first_tail":"...","first_tail_value":"...","position":n,"subgroup_position":n},...]}
+ *   first_tail and first_tail_value are only present for the CHOSEN_TAIL_PLUS_FIRST_TAIL states,
+ *   subgroup_position only for FIRST_TAIL_PLUS_POSITION, and the last segment (with no position) only has a label
+ *
+ * binary, after the 8 byte BINARY_MAGIC, with u32 = 4 bytes little-endian and str = u32 length (0xffffffff for null) + bytes:
+ *   u32 record length (not including itself), str path, str value, u32 number of segments, and for each segment
+ *   str label, str predicate, u32 state, str tail, str tail_value, str first_tail, str first_tail_value,
+ *   u32 position, u32 subgroup_position
+ *   The last segment has state 0 (NOT_DONE), null tails and position 0
+ */
+static void output_record(struct augsuggest *as, struct augeas_path_value *path_value_seg) {
+  struct path_segment *ps_ptr;
+  unsigned int num_segs = 0, ndx;
+  size_t start, path_len, record_start;
+
+  /* render the path, noting where each segment starts */
+  start = as->out_sink.len;
+  for( ps_ptr=path_value_seg->segments; ps_ptr != NULL; ps_ptr=ps_ptr->next) {
+    struct record_segment *seg;
+    size_t segment_len = strlen(ps_ptr->segment);
+    if( num_segs >= as->record_segs_size ) {
+      struct record_segment *segs_realloc;
+      as->record_segs_size = as->record_segs_size ? as->record_segs_size * 2 : 16;
+      segs_realloc = reallocarray(as->record_segs, as->record_segs_size, sizeof(struct record_segment));
+      CHECK_OOM( ! segs_realloc, fail_oom, "in output_record()");
+      as->record_segs = segs_realloc;
+    }
+    seg = &as->record_segs[num_segs++];
+    seg->ps = ps_ptr;
+    seg->start = as->out_sink.len - start;
+    seg->label_len = segment_len;
+    if( segment_len > 0 && ps_ptr->segment[segment_len-1] == '/' ) {
+      seg->label_len += as->noseq ? strlen("*") : strlen("seq::*");
+    }
+    seg->chosen_tail_state = ps_ptr->group ? ps_ptr->group->chosen_tail_state[ps_ptr->position] : NOT_DONE;
+    output_segment(as, ps_ptr, path_value_seg);
+  }
+  path_len = as->out_sink.len - start;
+  if( path_len + 1 > as->record_path_size ) {
+    as->record_path_size = path_len + 1;
+    free(as->record_path);
+    as->record_path = malloc(as->record_path_size);
+    CHECK_OOM( ! as->record_path, fail_oom, "in output_record()");
+  }
+  memcpy(as->record_path, as->out_sink.buf + start, path_len);
+  as->out_sink.len = start;
+
+  record_start = as->out_sink.len;
+  if( as->output_format == FORMAT_BINARY ) {
+    out_u32(as, 0);  /* record length, filled in below */
+  }
+  out_field(as, '{', "path", as->record_path, path_len);
+  out_field(as, ',', "value", path_value_seg->value, path_value_seg->value ? strlen(path_value_seg->value) : 0);
+  if( as->output_format == FORMAT_BINARY ) {
+    out_u32(as, num_segs);
+  } else {
+    out_str(as, ",\"segments\":[");
+  }
+  for( ndx=0; ndx<num_segs; ndx++ ) {
+    struct record_segment *seg = &as->record_segs[ndx];
+    struct group *group = seg->ps->group;
+    size_t end = ndx+1 < num_segs ? as->record_segs[ndx+1].start : path_len;
+    int plus_first = seg->chosen_tail_state >= CHOSEN_TAIL_PLUS_FIRST_TAIL_START && seg->chosen_tail_state <= CHOSEN_TAIL_PLUS_FIRST_TAIL_DONE;
+    if( as->output_format != FORMAT_BINARY && ndx > 0 ) {
+      out_char(as, ',');
+    }
+    out_field(as, '{', "label", as->record_path + seg->start, seg->label_len);
+    if( group == NULL && as->output_format != FORMAT_BINARY ) {
+      out_char(as, '}');
+      continue;
+    }
+    out_field(as, ',', "predicate", as->record_path + seg->start + seg->label_len, end - seg->start - seg->label_len);
+    if( as->output_format == FORMAT_BINARY ) {
+      out_u32(as, seg->chosen_tail_state);
+    } else {
+      out_field(as, ',', "state", chosen_tail_state_name(seg->chosen_tail_state), strlen(chosen_tail_state_name(seg->chosen_tail_state)));
+    }
+    out_tail_fields(as, "tail", "tail_value", group ? group->chosen_tail[seg->ps->position] : NULL);
+    out_tail_fields(as, "first_tail", "first_tail_value", group && plus_first ? group->first_tail[seg->ps->position]->tail : NULL);
+    if( as->output_format == FORMAT_BINARY ) {
+      out_u32(as, group ? seg->ps->position : 0);
+      out_u32(as, group && seg->chosen_tail_state == FIRST_TAIL_PLUS_POSITION ? group->subgroup_position[seg->ps->position] : 0);
+    } else {
+      out_uint_field(as, "position", seg->ps->position);
+      if( seg->chosen_tail_state == FIRST_TAIL_PLUS_POSITION ) {
+        out_uint_field(as, "subgroup_position", group->subgroup_position[seg->ps->position]);
+      }
+      out_char(as, '}');
+    }
+  }
+  if( as->output_format == FORMAT_BINARY ) {
+    uint32_t record_len = as->out_sink.len - record_start - 4;
+    size_t end = as->out_sink.len;
+    as->out_sink.len = record_start;
+    out_u32(as, record_len);
+    as->out_sink.len = end;
+    out_end_record(as);
+  } else {
+    out_str(as, "]}");
+    out_end_line(as);
+  }
+}
+
+/* position_selected()
+ * return true(1) if this position of the group is used by a path that will be output
+ * Without --query, every position is used
+ */
+static int position_selected(struct augsuggest *as, struct group *group, unsigned int position) {
+  if( as->num_queries == 0 )
+    return(1);
+  return( group->selected != NULL && group->selected[position] );
+}
+
+/* path_skipped()
+ * weed out null paths here, eg
+ *   /head/123 (null)
+ *   /head/123/tail (null)
+ *   /head/path (null)
+ * ie. if value==NULL AND this node has child nodes
+ * does not apply if there is no
+ *   /head/path/tail
+ * return true(1) if the path at all_augeas_paths[ndx] is not output for this reason
+ */
+static int path_skipped(struct augsuggest *as, int ndx) {
+  char *value = as->all_augeas_paths[ndx]->value;
+  if ( ( value == NULL || *value == '\0' ) && ndx < as->num_matched-1 ) {
+    return(str_ischild(as->all_augeas_paths[ndx]->path, as->all_augeas_paths[ndx+1]->path));
+  }
+  return(0);
+}
+
+/* count_position_paths()
+ * Count the paths to be output, starting at all_augeas_paths[ndx], with the same first segment group and position
+ * Stop counting at max
+ */
+static int count_position_paths(struct augsuggest *as, int ndx, int max) {
+  struct path_segment *first_seg = as->all_augeas_paths[ndx]->segments;
+  int count = 0;
+  for( ; ndx < as->num_matched && count < max; ndx++ ) {
+    if( as->all_augeas_paths[ndx]->segments->group != first_seg->group || as->all_augeas_paths[ndx]->segments->position != first_seg->position ) {
+      break;
+    }
+    if( as->all_augeas_paths[ndx]->selected && ! path_skipped(as, ndx) ) {
+      count++;
+    }
+  }
+  return(count);
+}
+
+/* done_state()
+ * The chosen_tail_state of a group position once all of its paths have been output
+ */
+static chosen_tail_state_t done_state(chosen_tail_state_t chosen_tail_state) {
+  switch( chosen_tail_state ) {
+    case CHOSEN_TAIL_START:
+    case CHOSEN_TAIL_WIP:
+      return(CHOSEN_TAIL_DONE);
+    case CHOSEN_TAIL_PLUS_FIRST_TAIL_START:
+    case CHOSEN_TAIL_PLUS_FIRST_TAIL_WIP:
+      return(CHOSEN_TAIL_PLUS_FIRST_TAIL_DONE);
+    default:
+      return(chosen_tail_state);
+  }
+}
+
+/* output_defnode()
+ * For --defnode, write "defnode node /head/label[ expr ]" for the first segment of the path
+ * The [ expr ] is always the final (DONE) form, which matches the node once it has been created
+ * defnode creates the node if it does not match anything yet, so no "or count()=0" is needed
+ */
+static void output_defnode(struct augsuggest *as, struct path_segment *ps_ptr) {
+  out_str(as, "defnode " AUGSUGGEST_DEFNODE_VAR " ");
+  render_segment(as, ps_ptr, done_state(ps_ptr->group->chosen_tail_state[ps_ptr->position]));
+  out_end_line(as);
+}
+
+static void output(struct augsuggest *as) {
+  int ndx;   /* index to matches() */
+  struct augeas_path_value  *path_value_seg;
+  char *value;
+  struct group *node_group = NULL;   /* --defnode, $node is the first segment for this group and position */
+  unsigned int node_position = 0;
+  int use_node = 0;
+  if( as->output_format == FORMAT_BINARY ) {
+    out_write(as, BINARY_MAGIC, sizeof(BINARY_MAGIC)-1);
+  }
+  for( ndx=0; ndx<as->num_matched; ndx++) {
+    path_value_seg = as->all_augeas_paths[ndx];
+    if( ! path_value_seg->selected ) {
+      /* not matched by --query */
+      continue;
+    }
+    value = path_value_seg->value;
+    if( value != NULL && *value == '\0' )
+      value = NULL;
+    if( as->verbose && as->output_format == FORMAT_TEXT ) {
+      out_str(as, "#   ");
+      out_str(as, path_value_seg->path);
+      if ( value != NULL ) {
+        out_str(as, "  ");
+        out_quoted(as, value, 0);
+      }
+      out_end_line(as);
+    }
+    LOG(LOG_OUTPUT, LOG_DETAIL, "#%3d %s %s",ndx, path_value_seg->path, path_value_seg->value);
+    if ( path_skipped(as, ndx) ) {
+      LOG(LOG_OUTPUT, LOG_DETAIL, " # %s (null) (skipped)", as->all_augeas_paths[ndx]->path);
+      continue;
+    }
+    if( as->output_format != FORMAT_TEXT ) {
+      output_record(as, path_value_seg);
+      continue;
+    }
+    if( as->use_defnode ) {
+      struct path_segment *first_seg = path_value_seg->segments;
+      if( first_seg->group == NULL ) {
+        node_group = NULL;
+        use_node = 0;
+      } else if( first_seg->group != node_group || first_seg->position != node_position ) {
+        /* first path of a new group position - only worth a defnode if there is more than one path */
+        node_group    = first_seg->group;
+        node_position = first_seg->position;
+        use_node = count_position_paths(as, ndx, 2) >= 2;
+        if( use_node ) {
+          output_defnode(as, first_seg);
+        }
+      }
+    }
+    output_path(as, path_value_seg, use_node);
+    if( as->pretty ) {
+      int next_ndx;
+      /* find the next path to be output */
+      for( next_ndx=ndx+1; next_ndx < as->num_matched && ! as->all_augeas_paths[next_ndx]->selected; next_ndx++ )
+        ;
+      if( next_ndx < as->num_matched ) {
+        /* fixme - do we just need to compare the position? */
+        struct group *this_group, *next_group;
+        this_group = as->all_augeas_paths[ndx]->segments->group;
+        next_group = as->all_augeas_paths[next_ndx]->segments->group;
+        if ( this_group != next_group
+          || ( this_group != NULL && as->all_augeas_paths[ndx]->segments->position != as->all_augeas_paths[next_ndx]->segments->position )
+          ) {
+          /* New group, put in a newline for visual seperation */
+          out_end_line(as);
+        }
+      }
+    }
+  }
+}
+
+/* ----- --apply ----- */
+
+/* save_chosen_tail_states()
+ * output_segment() moves each group position on through its chosen_tail_states as paths are written
+ * Keep a copy of the states set by choose_tail(), so that the paths can be written more than once
+ */
+static void save_chosen_tail_states(struct augsuggest *as) {
+  int ndx;
+  for( ndx=0; ndx<as->num_groups; ndx++ ) {
+    struct group *group = as->all_groups[ndx];
+    if( group->chosen_tail_state == NULL )
+      continue;
+    group->initial_state = malloc(sizeof(chosen_tail_state_t) * group->position_array_size);
+    CHECK_OOM( ! group->initial_state, fail_oom, "in save_chosen_tail_states()");
+    ACCOUNT_ALLOC(ALLOC_POSITION_ARRAYS, 1, 0, sizeof(chosen_tail_state_t) * group->position_array_size);
+    memcpy(group->initial_state, group->chosen_tail_state, sizeof(chosen_tail_state_t) * group->position_array_size);
+  }
+}
+
+static void restore_chosen_tail_states(struct augsuggest *as) {
+  int ndx;
+  for( ndx=0; ndx<as->num_groups; ndx++ ) {
+    struct group *group = as->all_groups[ndx];
+    if( group->initial_state == NULL )
+      continue;
+    memcpy(group->chosen_tail_state, group->initial_state, sizeof(chosen_tail_state_t) * group->position_array_size);
+  }
+}
+
+/* take_rendered()
+ * Remove the path rendered into out_sink since start, and return a copy of it with files_root replaced by tree
+ * Return NULL, with the reason in as->error, if a value in it could not be quoted (see out_api_quoted()),
+ * or if the path is not below files_root (should not happen)
+ */
+static char *take_rendered(struct augsuggest *as, size_t start, const char *tree) {
+  size_t root_len = strlen(as->files_root);
+  size_t len = as->out_sink.len - start;
+  char *path;
+  int result;
+  as->out_sink.len = start;
+  if( as->out_api_unquotable != NULL ) {
+    set_error(as, "%.*s: the value \"%s\" contains both ' and \", which a path-expression can not quote",
+                  (int) len, as->out_sink.buf + start, as->out_api_unquotable);
+    as->out_api_unquotable = NULL;
+    return(NULL);
+  }
+  if( len < root_len || strncmp(as->out_sink.buf + start, as->files_root, root_len) != 0 ) {
+    set_error(as, "%.*s is not below %s", (int) len, as->out_sink.buf + start, as->files_root);
+    return(NULL);
+  }
+  result = asprintf(&path, "%s%.*s", tree, (int) (len - root_len), as->out_sink.buf + start + root_len);
+  CHECK_OOM( result < 0, fail_oom, NULL);
+  return(path);
+}
+
+/* apply_paths()
+ * aug_set() each path that output() would write, with files_root replaced by tree
+ * The path-expressions are rendered by output_segment() into out_sink, in the form aug_set() takes (see out_compare()),
+ * and removed again afterwards
+ * --defnode makes no difference here, each path is set in full
+ * Return 0, or -1 with the path which could not be set in as->error
+ */
+static int apply_paths(struct augsuggest *as, const char *tree) {
+  int ndx;
+  int result = 0;
+  as->out_api = 1;
+  for( ndx=0; ndx<as->num_matched; ndx++) {
+    struct augeas_path_value *path_value_seg = as->all_augeas_paths[ndx];
+    struct path_segment *ps_ptr;
+    size_t start;
+    char *path;
+    if( ! path_value_seg->selected || path_skipped(as, ndx) )
+      continue;
+    start = as->out_sink.len;
+    for( ps_ptr=path_value_seg->segments; ps_ptr != NULL; ps_ptr=ps_ptr->next) {
+      output_segment(as, ps_ptr, path_value_seg);
+    }
+    path = take_rendered(as, start, tree);
+    if( path == NULL ) {
+      result = -1;
+      break;
+    }
+    LOG(LOG_OUTPUT, LOG_DETAIL, "aug_set(%s, %s)", path, path_value_seg->value);
+    if( aug_set(as->aug, path, path_value_seg->value) < 0 ) {
+      set_error(as, "could not set %s: %s", path, augeas_error_text(as));
+      free(path);
+      result = -1;
+      break;
+    }
+    free(path);
+  }
+  as->out_api = 0;
+  return(result);
+}
+
+/* read_text_file()
+ * Return the contents of filename, or "" if it does not exist, or NULL on error
+ */
+static char *read_text_file(struct augsuggest *as, const char *filename) {
+  FILE *fp;
+  char *text;
+  long size;
+  fp = fopen(filename, "r");
+  if( fp == NULL ) {
+    if( errno == ENOENT ) {
+      text = strdup("");
+      CHECK_OOM( ! text, fail_oom, "in read_text_file()");
+      return(text);
+    }
+    return(NULL);
+  }
+  if( fseek(fp, 0, SEEK_END) != 0 || ( size = ftell(fp) ) < 0 || fseek(fp, 0, SEEK_SET) != 0 ) {
+    fclose(fp);
+    return(NULL);
+  }
+  text = malloc(size + 1);
+  CHECK_OOM( ! text, fail_oom, "in read_text_file()");
+  if( fread(text, 1, size, fp) != (size_t) size ) {
+    free(text);
+    fclose(fp);
+    return(NULL);
+  }
+  text[size] = '\0';
+  fclose(fp);
+  return(text);
+}
+
+/* write_text_file()
+ * Replace filename with text, via a temporary file, fsync() and rename()
+ * The owner, group and mode of an existing file are kept, a new file gets 0666 less the umask, as augeas does
+ * Return 0 on success, -1 on error
+ */
+static int write_text_file(struct augsuggest *as, const char *filename, const char *text) {
+  char *tmp_file;
+  FILE *fp;
+  struct stat st;
+  int fd, exists;
+
+  exists = stat(filename, &st) == 0;
+  fd = create_temp_file(as, filename, exists ? 0600 : 0666, &tmp_file);
+  if( fd < 0 ) {
+    set_error(as, "could not create a temporary file for %s: %s", filename, strerror(errno));
+    free(tmp_file);
+    return(-1);
+  }
+  if( exists && ( fchown(fd, st.st_uid, st.st_gid) != 0 || fchmod(fd, st.st_mode & 07777) != 0 ) ) {
+    set_error(as, "could not set the owner and mode of %s: %s", tmp_file, strerror(errno));
+    close(fd);
+    unlink(tmp_file);
+    free(tmp_file);
+    return(-1);
+  }
+  fp = fdopen(fd, "w");
+  if( fp == NULL || fputs(text, fp) == EOF || fflush(fp) != 0 || fsync(fd) != 0 ) {
+    set_error(as, "could not write %s: %s", tmp_file, strerror(errno));
+    if( fp != NULL )
+      fclose(fp);
+    else
+      close(fd);
+    unlink(tmp_file);
+    free(tmp_file);
+    return(-1);
+  }
+  if( fclose(fp) != 0 ) {
+    set_error(as, "could not write %s: %s", tmp_file, strerror(errno));
+    unlink(tmp_file);
+    free(tmp_file);
+    return(-1);
+  }
+  if( rename(tmp_file, filename) != 0 ) {
+    set_error(as, "could not rename %s to %s: %s", tmp_file, filename, strerror(errno));
+    unlink(tmp_file);
+    free(tmp_file);
+    return(-1);
+  }
+  free(tmp_file);
+  return(0);
+}
+
+/* apply_lens_name()
+ * The lens used to load the file, as given by /augeas/load/<name>/lens, eg. @Hosts or Hosts.lns
+ */
+static char *apply_lens_name(struct augsuggest *as) {
+  char *load_lens, *result;
+  const char *value = NULL;
+  int ret;
+  ret = asprintf(&load_lens, "/augeas/load/%s/lens", as->schema_lens);
+  CHECK_OOM( ret < 0, fail_oom, NULL);
+  if( aug_get(as->aug, load_lens, &value) == 1 && value != NULL ) {
+    result = strdup(value);
+    CHECK_OOM( ! result, fail_oom, "in apply_lens_name()");
+  } else {
+    ret = asprintf(&result, "@%s", as->schema_lens);
+    CHECK_OOM( ret < 0, fail_oom, NULL);
+  }
+  free(load_lens);
+  return(result);
+}
+
+/* apply_to_root()
+ * Apply the set-commands to root/target directly, the same as
+ *    AUGEAS_ROOT=root augtool -f script
+ * but using the augeas handle and lens we already have
+ * The file is parsed with aug_text_store(), the paths are set below APPLY_TREE, and the result
+ * is written back with aug_text_retrieve()
+ * Return 0 on success, -1 with the reason in as->error
+ */
+static int apply_to_root(struct augsuggest *as, const char *root, const char *apply_lens) {
+  char *filename, *text;
+  const char *new_text = NULL;
+  int result;
+  result = asprintf(&filename, "%s%s", root, as->files_root + strlen("/files"));
+  CHECK_OOM( result < 0, fail_oom, NULL);
+  hold(as, filename);
+  LOG(LOG_OUTPUT, LOG_INFO, "apply_to_root() %s lens=%s", filename, apply_lens);
+
+  text = read_text_file(as, filename);
+  if( text == NULL ) {
+    set_error(as, "could not read %s: %s", filename, strerror(errno));
+    release(as, filename);
+    return(-1);
+  }
+  aug_rm(as->aug, APPLY_NODE);
+  aug_set(as->aug, APPLY_TEXT, text);
+  free(text);
+  if( aug_text_store(as->aug, apply_lens, APPLY_TEXT, APPLY_TREE) < 0 ) {
+    set_error(as, "could not parse %s using lens %s: %s", filename, apply_lens, aug_error_details(as->aug) ? aug_error_details(as->aug) : aug_error_message(as->aug));
+    aug_rm(as->aug, APPLY_NODE);
+    release(as, filename);
+    return(-1);
+  }
+  restore_chosen_tail_states(as);
+  if( apply_paths(as, APPLY_TREE) != 0 ) {
+    set_error(as, "could not apply changes to %s: %s", filename, as->error);
+    aug_rm(as->aug, APPLY_NODE);
+    release(as, filename);
+    return(-1);
+  }
+  if( aug_text_retrieve(as->aug, apply_lens, APPLY_TEXT, APPLY_TREE, APPLY_RESULT) < 0
+    || aug_get(as->aug, APPLY_RESULT, &new_text) != 1 || new_text == NULL ) {
+    set_error(as, "could not apply changes to %s: %s", filename, aug_error_details(as->aug) ? aug_error_details(as->aug) : aug_error_message(as->aug));
+    aug_rm(as->aug, APPLY_NODE);
+    release(as, filename);
+    return(-1);
+  }
+  result = write_text_file(as, filename, new_text);
+  aug_rm(as->aug, APPLY_NODE);
+  release(as, filename);
+  return(result);
+}
+
+/* ----- --diff ----- */
+
+/* cmp_live_node_path()
+ * qsort() and bsearch() comparison for (struct live_node *), by path
+ */
+static int cmp_live_node_path(const void *p1, const void *p2) {
+  return(strcmp((*(struct live_node * const *) p1)->path, (*(struct live_node * const *) p2)->path));
+}
+
+/* find_live_node()
+ * Return the node in the live target with this path, or NULL
+ */
+static struct live_node *find_live_node(struct augsuggest *as, char *path) {
+  struct live_node key, *key_ptr = &key, **found;
+  key.path = path;
+  found = bsearch(&key_ptr, as->live_sorted, as->num_live, sizeof(struct live_node *), cmp_live_node_path);
+  return( found ? *found : NULL );
+}
+
+/* load_live_target()
+ * For --diff, parse the current target file with the same lens as the input, into DIFF_LIVE
+ * A target which does not exist yet is treated as empty
+ */
+static void load_live_target(struct augsuggest *as, const char *filename) {
+  char *text, *live_lens;
+  char **live_matches;
+  int ndx;
+  text = read_text_file(as, filename);
+  if( text == NULL ) {
+    fatal(as, "could not read %s: %s", filename, strerror(errno));
+  }
+  hold(as, text);
+  live_lens = hold(as, apply_lens_name(as));
+  aug_set(as->aug, DIFF_TEXT, text);
+  release(as, text);
+  if( aug_text_store(as->aug, live_lens, DIFF_TEXT, DIFF_LIVE) < 0 ) {
+    fatal(as, "could not parse %s using lens %s: %s", filename, live_lens, aug_error_details(as->aug) ? aug_error_details(as->aug) : aug_error_message(as->aug));
+  }
+  release(as, live_lens);
+
+  as->num_live = aug_match(as->aug, DIFF_LIVE "/descendant::*", &live_matches);
+  if( as->num_live < 0 )
+    as->num_live = 0;
+  as->live_nodes  = malloc(sizeof(struct live_node) * (as->num_live+1));
+  as->live_sorted = malloc(sizeof(struct live_node *) * (as->num_live+1));
+  CHECK_OOM( ! as->live_nodes || ! as->live_sorted, fail_oom, "in load_live_target()");
+  for( ndx=0; ndx<as->num_live; ndx++ ) {
+    as->live_nodes[ndx].path    = live_matches[ndx];
+    aug_get(as->aug, live_matches[ndx], &as->live_nodes[ndx].value);
+    as->live_nodes[ndx].matched = 0;
+    as->live_nodes[ndx].unit    = NULL;
+    as->live_sorted[ndx] = &as->live_nodes[ndx];
+  }
+  free(live_matches);
+  qsort(as->live_sorted, as->num_live, sizeof(struct live_node *), cmp_live_node_path);
+  LOG(LOG_OUTPUT, LOG_INFO, "load_live_target() %s: %d nodes", filename, as->num_live);
+}
+
+/* unit_prefix_len()
+ * Length of the first segment of path, including its position, eg. /files/etc/hosts/3 in /files/etc/hosts/3/ipaddr
+ * This node, and everything below it, is a "unit" which is matched to the live target as a whole
+ * A path with no position is a unit by itself
+ */
+static size_t unit_prefix_len(char *path) {
+  char *head_end;
+  unsigned int position;
+  return( str_next_pos(path, &head_end, &position) - path );
+}
+
+/* same_unit()
+ * return true(1) if both paths have the same first segment
+ */
+static int same_unit(struct augsuggest *as, int ndx1, int ndx2) {
+  struct path_segment *seg1 = as->all_augeas_paths[ndx1]->segments;
+  struct path_segment *seg2 = as->all_augeas_paths[ndx2]->segments;
+  if( seg1->group == NULL || seg2->group == NULL )
+    return(0);
+  return( seg1->group == seg2->group && seg1->position == seg2->position );
+}
+
+/* find_live_unit()
+ * Find the node in the live target which is the same as the first segment of this path
+ * The first segment is rendered in its final (DONE) form, which is unique within the input,
+ * and identifies the same entry in the live target if it exists there
+ * It is rendered for aug_match(), without the augtool escapes - see out_compare()
+ */
+static struct live_node *find_live_unit(struct augsuggest *as, struct augeas_path_value *path_value_seg) {
+  struct path_segment *first_seg = path_value_seg->segments;
+  struct live_node *live = NULL;
+  size_t start = as->out_sink.len;
+  char *path;
+  char **unit_matches;
+  int num_unit_matches, ndx;
+  as->out_api = 1;
+  if( first_seg->group == NULL ) {
+    out_segment_label(as, first_seg);
+  } else {
+    render_segment(as, first_seg, done_state(first_seg->group->chosen_tail_state[first_seg->position]));
+  }
+  as->out_api = 0;
+  path = take_rendered(as, start, DIFF_LIVE);
+  if( path == NULL )
+    return(NULL);
+  num_unit_matches = aug_match(as->aug, path, &unit_matches);
+  if( num_unit_matches == 1 ) {
+    live = find_live_node(as, unit_matches[0]);
+  }
+  LOG(LOG_OUTPUT, LOG_DETAIL, "find_live_unit() %s: %d matches", path, num_unit_matches);
+  for( ndx=0; ndx<num_unit_matches; ndx++ )
+    free(unit_matches[ndx]);
+  if( num_unit_matches > 0 )
+    free(unit_matches);
+  free(path);
+  return(live);
+}
+
+/* find_live_path()
+ * Find the node in the live target for this path, within the live unit
+ */
+static struct live_node *find_live_path(struct augsuggest *as, struct live_node *live_unit, char *path) {
+  struct live_node *live;
+  char *live_path;
+  int result;
+  result = asprintf(&live_path, "%s%s", live_unit->path, path + unit_prefix_len(path));
+  CHECK_OOM( result < 0, fail_oom, NULL);
+  live = find_live_node(as, live_path);
+  free(live_path);
+  return(live);
+}
+
+/* live_addressed()
+ * return true(1) if the path-expression for this input path finds the given node in the live target
+ * Segments below the unit have their own [ expr ], which finds a different node (or none) if a value used in it
+ * has changed in the live target, eg. alias[.='localhost4'] - such a node is removed, and set again
+ */
+static int live_addressed(struct augsuggest *as, struct augeas_path_value *path_value_seg, struct live_node *live) {
+  struct path_segment *ps_ptr, *last_grouped = NULL;
+  size_t start = as->out_sink.len;
+  char *path;
+  char **live_matches;
+  int num_live_matches, ndx;
+  int addressed;
+  for( ps_ptr=path_value_seg->segments->next; ps_ptr != NULL; ps_ptr=ps_ptr->next ) {
+    if( ps_ptr->group != NULL )
+      last_grouped = ps_ptr;
+  }
+  if( last_grouped == NULL ) {
+    /* nothing but labels below the unit, the same as the live path */
+    return(1);
+  }
+  as->out_api = 1;
+  for( ps_ptr=path_value_seg->segments; ps_ptr != NULL; ps_ptr=ps_ptr->next ) {
+    if( ps_ptr->group == NULL ) {
+      out_segment_label(as, ps_ptr);
+    } else {
+      render_segment(as, ps_ptr, done_state(ps_ptr->group->chosen_tail_state[ps_ptr->position]));
+    }
+  }
+  as->out_api = 0;
+  path = take_rendered(as, start, DIFF_LIVE);
+  if( path == NULL )
+    return(0);
+  num_live_matches = aug_match(as->aug, path, &live_matches);
+  addressed = ( num_live_matches == 1 && strcmp(live_matches[0], live->path) == 0 );
+  LOG(LOG_OUTPUT, LOG_DETAIL, "live_addressed() %s: %d matches, addressed=%d", path, num_live_matches, addressed);
+  for( ndx=0; ndx<num_live_matches; ndx++ )
+    free(live_matches[ndx]);
+  if( num_live_matches > 0 )
+    free(live_matches);
+  free(path);
+  return(addressed);
+}
+
+static int same_value(const char *value1, const char *value2) {
+  if( value1 == NULL || value2 == NULL )
+    return( value1 == value2 );
+  return( strcmp(value1, value2) == 0 );
+}
+
+/* output_rm()
+ * Write an rm-command for a node in the live target which is not in the input
+ * If the node is within a unit which is also in the input, that unit is found by its final [ expr ],
+ * otherwise the node is found by its position in the live target
+ */
+static void output_rm(struct augsuggest *as, struct live_node *live) {
+  char *rel = live->path + strlen(DIFF_LIVE);
+  struct live_node *live_unit;
+  char *unit_path, *live_unit_path;
+  int result;
+  /* find the unit containing this node, in the same way as for the input paths */
+  result = asprintf(&unit_path, "%s%s", as->files_root, rel);
+  CHECK_OOM( result < 0, fail_oom, NULL);
+  unit_path[unit_prefix_len(unit_path)] = '\0';
+  result = asprintf(&live_unit_path, "%s%s", DIFF_LIVE, unit_path + strlen(as->files_root));
+  CHECK_OOM( result < 0, fail_oom, NULL);
+  live_unit = find_live_node(as, live_unit_path);
+  free(live_unit_path);
+  free(unit_path);
+
+  out_str(as, "rm ");
+  if( live_unit != NULL && live_unit->unit != NULL && live_unit->unit->segments->group != NULL ) {
+    struct path_segment *first_seg = live_unit->unit->segments;
+    render_segment(as, first_seg, done_state(first_seg->group->chosen_tail_state[first_seg->position]));
+    out_str(as, live->path + strlen(live_unit->path));
+  } else {
+    out_str(as, as->files_root);
+    out_str(as, rel);
+  }
+  out_end_line(as);
+}
+
+/* output_diff()
+ * --diff, write only the commands needed to change the live target into the input
+ *  - rm-commands for nodes in the live target which are not in the input, last first so that positions stay valid
+ *  - set-commands for nodes which are not in the live target, or have a different value there
+ * Each unit (first segment) of the input is matched to the live target by its final [ expr ], and the
+ * nodes below it by their path relative to the unit
+ */
+static void output_diff(struct augsuggest *as) {
+  struct live_node **unit_live;   /* index is the first path of each unit */
+  struct live_node **path_live;   /* the live node found by each path, NULL if none */
+  char *removed = NULL;
+  int ndx, live_ndx;
+  int unit_start = 0;
+  int last_unit_out = -1;         /* for --pretty */
+
+  unit_live = calloc(as->num_matched, sizeof(struct live_node *));
+  path_live = calloc(as->num_matched, sizeof(struct live_node *));
+  CHECK_OOM( ! unit_live || ! path_live, fail_oom, "in output_diff()");
+
+  /* match each unit of the input to the live target */
+  for( ndx=0; ndx<as->num_matched; ndx++ ) {
+    struct live_node *live;
+    if( ndx == 0 || ! same_unit(as, ndx-1, ndx) ) {
+      unit_start = ndx;
+      unit_live[ndx] = find_live_unit(as, as->all_augeas_paths[ndx]);
+      if( unit_live[ndx] != NULL )
+        unit_live[ndx]->unit = as->all_augeas_paths[ndx];
+    }
+    if( unit_live[unit_start] == NULL )
+      continue;
+    live = find_live_path(as, unit_live[unit_start], as->all_augeas_paths[ndx]->path);
+    if( live != NULL && live_addressed(as, as->all_augeas_paths[ndx], live) ) {
+      live->matched = 1;
+      path_live[ndx] = live;
+    }
+  }
+
+  /* nodes below a node being removed go with it */
+  for( live_ndx=0; live_ndx<as->num_live; live_ndx++ ) {
+    if( as->live_nodes[live_ndx].matched )
+      continue;
+    if( removed != NULL && str_ischild(removed, as->live_nodes[live_ndx].path) ) {
+      as->live_nodes[live_ndx].matched = -1;
+    } else {
+      removed = as->live_nodes[live_ndx].path;
+    }
+  }
+  for( live_ndx=as->num_live-1; live_ndx>=0; live_ndx-- ) {
+    if( ! as->live_nodes[live_ndx].matched ) {
+      output_rm(as, &as->live_nodes[live_ndx]);
+      last_unit_out = as->num_matched;
+    }
+  }
+
+  for( ndx=0; ndx<as->num_matched; ndx++ ) {
+    struct augeas_path_value *path_value_seg = as->all_augeas_paths[ndx];
+    struct path_segment *first_seg = path_value_seg->segments;
+    if( ndx == 0 || ! same_unit(as, ndx-1, ndx) ) {
+      unit_start = ndx;
+      if( unit_live[ndx] != NULL && first_seg->group != NULL ) {
+        /* the chosen tail is already in the live target, the final [ expr ] finds it */
+        first_seg->group->chosen_tail_state[first_seg->position] = done_state(first_seg->group->chosen_tail_state[first_seg->position]);
+      }
+    }
+    if( path_skipped(as, ndx) )
+      continue;
+    if( path_live[ndx] != NULL && same_value(path_live[ndx]->value, path_value_seg->value) ) {
+      /* unchanged - render it anyway, so the chosen_tail_states move on as if it had been written */
+      struct path_segment *ps_ptr;
+      size_t start = as->out_sink.len;
+      for( ps_ptr=first_seg; ps_ptr != NULL; ps_ptr=ps_ptr->next) {
+        output_segment(as, ps_ptr, path_value_seg);
+      }
+      as->out_sink.len = start;
+      continue;
+    }
+    if( as->pretty && last_unit_out >= 0 && last_unit_out != unit_start ) {
+      /* New group, put in a newline for visual seperation */
+      out_end_line(as);
+    }
+    output_path(as, path_value_seg, 0);
+    last_unit_out = unit_start;
+  }
+  free(path_live);
+  free(unit_live);
+}
+
+/* cmp_tail_value()
+ * qsort() comparison for (struct tail *), by simple_tail then value, with NULL values first
+ */
+static int cmp_tail_value(const void *p1, const void *p2) {
+  const struct tail *t1 = *(struct tail * const *) p1;
+  const struct tail *t2 = *(struct tail * const *) p2;
+  int result = strcmp(t1->simple_tail, t2->simple_tail);
+  if( result != 0 )
+    return(result);
+  if( t1->value == NULL || t2->value == NULL )
+    return( (t2->value == NULL) - (t1->value == NULL) );
+  return(strcmp(t1->value, t2->value));
+}
+
+/* find_re_widths()
+ * Set tail->re_width for every tail in the group - the minimum width of regexp needed to
+ * distinguish the value from every other value with the same simple_tail
+ * ie. 1 + the longest prefix shared with any other value, as found by value_cmp()
+ *
+ * The tails are sorted by simple_tail and value, so that the longest shared prefix
+ * for each value is found by comparing it with its neighbours only
+ * value_cmp() treats ']' as matching any character (']' is written as '.' in the regexp), so values
+ * containing ']' do not sort next to the values they match - these are compared with every other
+ * value with the same simple_tail instead
+ */
+static void find_re_widths(struct augsuggest *as, struct group *group) {
+  struct tail  *tail_ptr;
+  struct tail **sorted;
+  unsigned int  num_tails = 0;
+  unsigned int  bucket_start, bucket_end, ndx, ndx2;
+  unsigned int  re_width;
+
+  for(tail_ptr = group->all_tails; tail_ptr != NULL; tail_ptr = tail_ptr->next) {
+    num_tails++;
+  }
+  sorted = malloc(sizeof(struct tail *) * (num_tails+1));
+  CHECK_OOM( ! sorted, fail_oom, "in find_re_widths()");
+
+  num_tails = 0;
+  for(tail_ptr = group->all_tails; tail_ptr != NULL; tail_ptr = tail_ptr->next) {
+    sorted[num_tails++] = tail_ptr;
+  }
+  qsort(sorted, num_tails, sizeof(struct tail *), cmp_tail_value);
+
+  for( bucket_start=0; bucket_start < num_tails; bucket_start=bucket_end ) {
+    struct tail *prev_plain = NULL;
+    /* find the end of this bucket of tails with the same simple_tail */
+    for( bucket_end=bucket_start+1; bucket_end < num_tails; bucket_end++ ) {
+      if( strcmp(sorted[bucket_end]->simple_tail, sorted[bucket_start]->simple_tail) != 0 )
+        break;
+    }
+    /* a value on its own needs no regexp width, otherwise at least 1 */
+    for( ndx=bucket_start; ndx < bucket_end; ndx++ ) {
+      sorted[ndx]->re_width = (bucket_end - bucket_start > 1);
+    }
+    for( ndx=bucket_start; ndx < bucket_end; ndx++ ) {
+      tail_ptr = sorted[ndx];
+      if( tail_ptr->value == NULL ) {
+        /* no prefix in common with anything */
+        continue;
+      }
+      if( strchr(tail_ptr->value, ']') != NULL ) {
+        /* compare with every other value in the bucket */
+        for( ndx2=bucket_start; ndx2 < bucket_end; ndx2++ ) {
+          if( ndx2 == ndx || sorted[ndx2]->value == NULL )
+            continue;
+          value_cmp(as, tail_ptr->value, sorted[ndx2]->value, &re_width);
+          tail_ptr->re_width     = MAX(tail_ptr->re_width,     re_width+1);
+          sorted[ndx2]->re_width = MAX(sorted[ndx2]->re_width, re_width+1);
+        }
+        continue;
+      }
+      if( prev_plain != NULL ) {
+        /* compare with the previous value without a ']' in sorted order */
+        value_cmp(as, tail_ptr->value, prev_plain->value, &re_width);
+        tail_ptr->re_width   = MAX(tail_ptr->re_width,   re_width+1);
+        prev_plain->re_width = MAX(prev_plain->re_width, re_width+1);
+      }
+      prev_plain = tail_ptr;
+    }
+  }
+  free(sorted);
+}
+
+static void choose_re_width(struct augsuggest *as, struct group *group) {
+  unsigned int position;
+  /* For each position, the minimum required length of the RE is the re_width of
+   * the chosen_tail (and the first_tail for the 3rd preference), set by find_re_widths() in choose_all_tails()
+   */
+  for(position=1; position<=group->max_position; position++) {
+    unsigned int max_re_width_ct=0;
+    unsigned int max_re_width_ft=0;
+    struct tail *chosen_tail = group->chosen_tail[position];
+    struct tail *first_tail;
+    if( ! position_selected(as, group, position) || chosen_tail == NULL ) {
+      continue;
+    }
+    first_tail = group->first_tail[position]->tail;
+    max_re_width_ct = chosen_tail->re_width;
+    LOG(LOG_REGEXP, LOG_DETAIL, "chosen_tail_state = %d", group->chosen_tail_state[position]);
+    if( group->chosen_tail_state[position] == CHOSEN_TAIL_PLUS_FIRST_TAIL_START && chosen_tail != first_tail ) {
+      /* 3rd preference, we need an re_width for both the chosen_tail and the first_tail */
+      max_re_width_ft = first_tail->re_width;
+    }
+    max_re_width_ct = MAX(max_re_width_ct,as->use_regexp);
+    max_re_width_ft = MAX(max_re_width_ft,as->use_regexp);
+    group->re_width_ct[position] = max_re_width_ct;
+    group->re_width_ft[position] = max_re_width_ft;
+    chosen_tail->value_re = value_regexp( as, chosen_tail->dict, max_re_width_ct );
+    if ( group->chosen_tail_state[position] == CHOSEN_TAIL_PLUS_FIRST_TAIL_START ) {
+      /* otherwise, max_re_width_ft=0, and we don't need first_tail->value_re at all */
+      if ( chosen_tail == first_tail ) {
+        /* if chosen_tail == first_tail, we would overwrite chosen_tail->value_re */
+        first_tail->value_re = chosen_tail->value_re;
+      } else {
+        first_tail->value_re  = value_regexp( as, first_tail->dict,  max_re_width_ft );
+      }
+    }
+    LOG(LOG_REGEXP, LOG_DETAIL, "# %s[%u] chosen_tail=%-20s %u %s", group->head, position, chosen_tail->simple_tail, max_re_width_ct, chosen_tail->value_re);
+    LOG(LOG_REGEXP, LOG_DETAIL, "# %s[%u]  first_tail=%-20s %u %s", group->head, position,  first_tail->simple_tail, max_re_width_ft,  first_tail->value_re);
+  } /* for position 1..max_position */
+}
+
+/* choose_pretty_width()
+ * All positions with the same chosen_tail->simple_tail are padded to the same width, being
+ * the widest value in that bucket which is no wider than MAX_PRETTY_WIDTH
+ * tail->stats is shared by all tails with the same simple_tail, so it is used as the bucket
+ */
+static void choose_pretty_width(struct augsuggest *as, struct group *group) {
+  unsigned int position;
+  unsigned int value_len;
+  struct tail_stats *stats;
+  for( stats = group->tail_stats; stats != NULL; stats=stats->next ) {
+    stats->pretty_width = 0;
+  }
+  for(position=1; position<=group->max_position; position++) {
+    struct tail *pretty_tail;
+    if( ! position_selected(as, group, position) || group->chosen_tail[position] == NULL ) {
+      continue;
+    }
+    if( group->chosen_tail_state[position] == CHOSEN_TAIL_PLUS_FIRST_TAIL_START ) {
+      pretty_tail = group->first_tail[position]->tail;
+    } else {
+      pretty_tail = group->chosen_tail[position];
+    }
+    if( as->use_regexp ) {
+      value_len = pretty_tail->value_re == NULL ? 0 : strlen(pretty_tail->value_re);
+    } else {
+      value_len = pretty_tail->value == NULL ? 0 : quoted_length(pretty_tail->value, NULL);
+    }
+    if( value_len <= MAX_PRETTY_WIDTH ) {
+      /* If we're already over the limit, do not pad everything else out too */
+      stats = group->chosen_tail[position]->stats;
+      stats->pretty_width = MAX(stats->pretty_width, value_len);
+    }
+  }
+  for(position=1; position<=group->max_position; position++) {
+    if( ! position_selected(as, group, position) || group->chosen_tail[position] == NULL ) {
+      continue;
+    }
+    group->pretty_width_ct[position] = group->chosen_tail[position]->stats->pretty_width;
+  }
+}
+
+/* degrade_group()
+ * Called when one of --max-positions --max-candidates or --time-limit is exceeded
+ * Use the fallback (first_tail plus position) for every remaining position in the group
+ * without calling choose_tail()
+ * subgroup_position[] is found in a single pass over tails_at_position[], instead of
+ * using find_or_create_subgroup() for each first_tail, with the same result
+ */
+static void degrade_group(struct augsuggest *as, struct group *group, unsigned int from_position, const char *reason) {
+  unsigned int position;
+  struct tail *tail;
+  struct tail_stub *tail_stub_ptr;
+  fprintf(stderr, "Warning: %s: %s exceeded, using positions for %u entries\n", group->head, reason, group->max_position - from_position + 1);
+  if ( ! group->subgroup_position ) {
+    group->subgroup_position = malloc( (group->max_position+1) * sizeof( unsigned int ));
+    CHECK_OOM( ! group->subgroup_position, fail_oom, "in degrade_group()");
+    ACCOUNT_ALLOC(ALLOC_SUBGROUP, 1, 0, (group->max_position+1) * sizeof(unsigned int));
+  }
+  for( tail = group->all_tails; tail != NULL; tail=tail->next ) {
+    tail->positions_seen = 0;
+    tail->last_position_seen = 0;
+  }
+  for( position=1; position<=group->max_position; position++ ) {
+    /* count the positions where each tail+value appears - this is the same as subgroup->matching_positions[] */
+    for( tail_stub_ptr = group->tails_at_position[position]; tail_stub_ptr != NULL; tail_stub_ptr=tail_stub_ptr->next ) {
+      if( tail_stub_ptr->tail->last_position_seen != position ) {
+        tail_stub_ptr->tail->last_position_seen = position;
+        tail_stub_ptr->tail->positions_seen++;
+      }
+    }
+    if( position < from_position || ! position_selected(as, group, position) ) {
+      continue;
+    }
+    if( group->first_tail[position] == NULL ) {
+      group->chosen_tail_state[position] = NO_CHILD_NODES;
+      group->chosen_tail[position] = NULL;
+      continue;
+    }
+    tail = group->first_tail[position]->tail;
+    group->chosen_tail[position] = tail;
+    group->chosen_tail_state[position] = FIRST_TAIL_PLUS_POSITION;
+    group->subgroup_position[position] = tail->positions_seen;
+  }
+}
+
+/* ----- --verify ----- */
+
+/* augeas_error_text()
+ * The most detailed augeas error message available
+ */
+static const char *augeas_error_text(struct augsuggest *as) {
+  const char *message = aug_error_details(as->aug);
+  if( message == NULL )
+    message = aug_error_message(as->aug);
+  return( message ? message : "unknown error" );
+}
+
+/* compare_trees()
+ * Compare the nodes below tree1 and tree2 one by one, in document order, by their path relative to the tree and their value
+ * Return the number of nodes compared, or -1 with the first difference in as->error
+ */
+static int compare_trees(struct augsuggest *as, const char *tree1, const char *tree2) {
+  char *match1, *match2;
+  char **nodes1, **nodes2;
+  size_t len1 = strlen(tree1), len2 = strlen(tree2);
+  int num1, num2, ndx, result;
+  result = asprintf(&match1, "%s/descendant::*", tree1);
+  CHECK_OOM( result < 0, fail_oom, NULL);
+  hold(as, match1);
+  result = asprintf(&match2, "%s/descendant::*", tree2);
+  CHECK_OOM( result < 0, fail_oom, NULL);
+  num1 = aug_match(as->aug, match1, &nodes1);
+  num2 = aug_match(as->aug, match2, &nodes2);
+  release(as, match1);
+  free(match2);
+  if( num1 < 0 || num2 < 0 ) {
+    set_error(as, "could not match the nodes below %s and %s: %s", tree1, tree2, augeas_error_text(as));
+    result = -1;
+  } else {
+    result = MIN(num1, num2);
+  }
+  for( ndx=0; result >= 0 && ndx<MIN(num1, num2); ndx++ ) {
+    const char *value1 = NULL, *value2 = NULL;
+    aug_get(as->aug, nodes1[ndx], &value1);
+    aug_get(as->aug, nodes2[ndx], &value2);
+    LOG(LOG_OUTPUT, LOG_ELEMENT, "compare_trees() %s = %s, %s = %s", nodes1[ndx], value1, nodes2[ndx], value2);
+    if( strcmp(nodes1[ndx] + len1, nodes2[ndx] + len2) != 0 || ! same_value(value1, value2) ) {
+      set_error(as, "node %d differs: %s = '%s' in the input, but %s = '%s' after the round trip",
+                ndx+1, nodes1[ndx] + len1, value1 ? value1 : "(none)", nodes2[ndx] + len2, value2 ? value2 : "(none)");
+      result = -1;
+      break;
+    }
+  }
+  if( result >= 0 && num1 != num2 ) {
+    set_error(as, "%d nodes in the input, but %d after the round trip, the first extra node is %s",
+              num1, num2, num1 > num2 ? nodes1[num2] + len1 : nodes2[num1] + len2);
+    result = -1;
+  }
+  for( ndx=0; ndx<num1; ndx++ )
+    free(nodes1[ndx]);
+  for( ndx=0; ndx<num2; ndx++ )
+    free(nodes2[ndx]);
+  if( num1 >= 0 )
+    free(nodes1);
+  if( num2 >= 0 )
+    free(nodes2);
+  return(result);
+}
+
+/* first_line_difference()
+ * Return the line number of the first line which differs between text1 and text2
+ */
+static int first_line_difference(const char *text1, const char *text2) {
+  int line = 1;
+  for( ; *text1 && *text1 == *text2; text1++, text2++ ) {
+    if( *text1 == '\n' )
+      line++;
+  }
+  return(line);
+}
+
+/* run_script()
+ * Run the script with aug_srun(), as augtool would, what is the tree it is applied to for the error message
+ * Return 0 on success, -1 with the reason in as->error
+ */
+static int run_script(struct augsuggest *as, const char *script, const char *what) {
+  char *out_text = NULL;
+  size_t out_len = 0;
+  FILE *out;
+  int result;
+  out = open_memstream(&out_text, &out_len);
+  CHECK_OOM( out == NULL, fail_oom, "in run_script()");
+  result = aug_srun(as->aug, out, script);
+  fclose(out);
+  LOG(LOG_OUTPUT, LOG_INFO, "run_script() %s: aug_srun()=%d %s", what, result, out_text);
+  if( result < 0 ) {
+    set_error(as, "the script failed when applied to %s: %s%s%s", what, augeas_error_text(as), *out_text ? "\n" : "", out_text);
+  }
+  free(out_text);
+  return( result < 0 ? -1 : 0 );
+}
+
+/* verify_round_trip()
+ * With the input moved out of the way to VERIFY_INPUT, run the script on an empty tree at files_root,
+ * save it to text and parse that again with the same lens, and compare the result with the input, node by node
+ * Then load the saved text at files_root and run the script a second time, which must not change the saved text
+ * All of this is done in the tree with aug_text_store() and aug_text_retrieve(), nothing is written to disk
+ * Return 0 on success, -1 with the reason in as->error
+ */
+static int verify_round_trip(struct augsuggest *as, const char *lens, const char *script) {
+  const char *text = NULL, *again = NULL;
+  int num_nodes;
+
+  aug_set(as->aug, VERIFY_EMPTY, "");
+  if( aug_text_store(as->aug, lens, VERIFY_EMPTY, as->files_root) < 0 ) {
+    set_error(as, "could not create an empty tree using lens %s: %s", lens, augeas_error_text(as));
+    return(-1);
+  }
+  if( run_script(as, script, "an empty tree") < 0 )
+    return(-1);
+  if( aug_text_retrieve(as->aug, lens, VERIFY_EMPTY, as->files_root, VERIFY_TEXT) < 0
+    || aug_get(as->aug, VERIFY_TEXT, &text) != 1 || text == NULL ) {
+    set_error(as, "could not save the tree using lens %s: %s", lens, augeas_error_text(as));
+    return(-1);
+  }
+  if( aug_text_store(as->aug, lens, VERIFY_TEXT, VERIFY_REPARSED) < 0 ) {
+    set_error(as, "could not parse the saved tree again using lens %s: %s", lens, augeas_error_text(as));
+    return(-1);
+  }
+  num_nodes = compare_trees(as, VERIFY_INPUT, VERIFY_REPARSED);
+  if( num_nodes < 0 )
+    return(-1);
+  LOG(LOG_OUTPUT, LOG_INFO, "verify_round_trip() %d nodes are the same after the round trip", num_nodes);
+
+  if( aug_text_store(as->aug, lens, VERIFY_TEXT, as->files_root) < 0 ) {
+    set_error(as, "could not parse the saved tree again using lens %s: %s", lens, augeas_error_text(as));
+    return(-1);
+  }
+  if( run_script(as, script, "the saved tree") < 0 )
+    return(-1);
+  if( aug_text_retrieve(as->aug, lens, VERIFY_TEXT, as->files_root, VERIFY_AGAIN) < 0
+    || aug_get(as->aug, VERIFY_AGAIN, &again) != 1 || again == NULL ) {
+    set_error(as, "could not save the tree a second time using lens %s: %s", lens, augeas_error_text(as));
+    return(-1);
+  }
+  if( strcmp(text, again) != 0 ) {
+    set_error(as, "running the script a second time changes line %d of the saved file", first_line_difference(text, again));
+    return(-1);
+  }
+  LOG(LOG_OUTPUT, LOG_INFO, "verify_round_trip() running the script a second time makes no changes");
+  return(0);
+}
+
+/* restore_verify_input()
+ * Put the input back at files_root, if verify_round_trip() moved it to VERIFY_INPUT, and remove the scratch trees
+ */
+static void restore_verify_input(struct augsuggest *as) {
+  const char *value;
+  if( as->aug == NULL )
+    return;
+  if( aug_get(as->aug, VERIFY_INPUT, &value) == 1 ) {
+    aug_rm(as->aug, as->files_root);
+    aug_mv(as->aug, VERIFY_INPUT, as->files_root);
+  }
+  aug_rm(as->aug, APPLY_NODE);
+}
+
+/* ----- --trace ----- */
+
+/* trace_string()
+ * Write str as a JSON string to the trace file
+ */
+static void trace_string(struct augsuggest *as, const char *str) {
+  const char *s;
+  putc('"', as->trace_fp);
+  for( s=str; *s; s++ ) {
+    if( *s == '"' || *s == '\\' ) {
+      fprintf(as->trace_fp, "\\%c", *s);
+    } else if( (unsigned char) *s < 0x20 ) {
+      fprintf(as->trace_fp, "\\u%04x", *s);
+    } else {
+      putc(*s, as->trace_fp);
+    }
+  }
+  putc('"', as->trace_fp);
+}
+
+/* trace_start_event()
+ * Write the fields common to every trace event, ts is in seconds, the trace file has microseconds
+ * The caller writes any further fields, and the closing }
+ */
+static void trace_start_event(struct augsuggest *as, const char *ph, const char *name, const char *cat, double ts) {
+  fprintf(as->trace_fp, "%s{\"name\":", as->trace_events++ ? ",\n" : "");
+  trace_string(as, name);
+  fprintf(as->trace_fp, ",\"cat\":\"%s\",\"ph\":\"%s\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d", cat, ph, ts*1e6, (int) getpid(), (int) gettid());
+}
+
+/* trace_span()
+ * A complete ("X") event from start to end, with an optional head argument for the group
+ */
+static void trace_span(struct augsuggest *as, const char *name, const char *cat, double start, double end, struct group *group) {
+  trace_start_event(as, "X", name, cat, start);
+  fprintf(as->trace_fp, ",\"dur\":%.3f", (end-start)*1e6);
+  if( group != NULL ) {
+    fprintf(as->trace_fp, ",\"args\":{\"head\":");
+    trace_string(as, group->head);
+    fprintf(as->trace_fp, ",\"max_position\":%u,\"candidates\":%u}", group->max_position, group->candidates_examined);
+  }
+  fprintf(as->trace_fp, "}");
+}
+
+/* trace_memory()
+ * A counter ("C") event with the bytes allocated for the analysis structures (see --alloc-stats), and the peak RSS
+ */
+static void trace_memory(struct augsuggest *as, double ts) {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  trace_start_event(as, "C", "memory", "memory", ts);
+  fprintf(as->trace_fp, ",\"args\":{\"analysis_bytes\":%zu,\"process_peak_rss_kb\":%ld}}", as->alloc_total.live, usage.ru_maxrss);
+}
+
+/* trace_file()
+ * Begin ("B") or end ("E") the span of the input file, which lasts until augsuggest_free()
+ */
+static void trace_file(struct augsuggest *as, const char *ph, const char *filename) {
+  struct phase_time now;
+  stats_now(&now);
+  trace_start_event(as, ph, "file", "file", now.wall);
+  if( filename != NULL ) {
+    fprintf(as->trace_fp, ",\"args\":{\"file\":");
+    trace_string(as, filename);
+    fprintf(as->trace_fp, "}");
+  }
+  fprintf(as->trace_fp, "}");
+}
+
+/* ----- --stats ----- */
+
+/* stats_now()
+ * Wall (monotonic) and CPU time now, in seconds
+ * The CPU time is for this thread, so that contexts used from separate threads each count their own
+ */
+static void stats_now(struct phase_time *now) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  now->wall = ts.tv_sec + ts.tv_nsec / 1e9;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  now->cpu = ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* alloc_account()
+ * --alloc-stats, count calls allocations of new_bytes, replacing old_bytes (0 for malloc()), of type
+ * with new_bytes=0 and calls=0, old_bytes have been freed
+ */
+static void alloc_account(struct augsuggest *as, alloc_type_t type, unsigned int calls, size_t old_bytes, size_t new_bytes) {
+  struct alloc_count *counts[] = { &as->alloc_types[type], &as->alloc_total };
+  unsigned int ndx;
+  for( ndx=0; ndx<2; ndx++ ) {
+    counts[ndx]->count += calls;
+    counts[ndx]->bytes += new_bytes;
+    counts[ndx]->live  += new_bytes - old_bytes;
+    counts[ndx]->peak   = MAX(counts[ndx]->peak, counts[ndx]->live);
+  }
+  as->alloc_pending.count += calls;
+  as->alloc_pending.bytes += new_bytes;
+  as->alloc_pending.peak   = MAX(as->alloc_pending.peak, as->alloc_total.live);
+}
+
+/* alloc_phase_end()
+ * --alloc-stats, add the allocations since the last phase ended to this phase
+ */
+static void alloc_phase_end(struct augsuggest *as, stats_phase_t phase) {
+  struct alloc_count *counts = &as->alloc_phases[phase];
+  counts->count += as->alloc_pending.count;
+  counts->bytes += as->alloc_pending.bytes;
+  counts->live   = as->alloc_total.live;
+  counts->peak   = MAX(counts->peak, as->alloc_pending.peak);
+  as->alloc_pending.count = 0;
+  as->alloc_pending.bytes = 0;
+  as->alloc_pending.peak  = as->alloc_total.live;
+}
+
+/* stats_phase_end()
+ * Add the time since phase_mark to this phase, and start the next phase now
+ */
+static void stats_phase_end(struct augsuggest *as, stats_phase_t phase) {
+  struct phase_time now;
+  PROBE1(phase_end, phase_names[phase]);
+  log_phase_end(as);
+  if( as->count_allocs )
+    alloc_phase_end(as, phase);
+  if( ! as->show_stats && ! as->trace_fp )
+    return;
+  stats_now(&now);
+  if( as->trace_fp ) {
+    trace_span(as, phase_names[phase], "phase", as->phase_mark.wall, now.wall, NULL);
+    /* choose_all_tails() ends these once per group, and writes the memory counter after the last group */
+    if( phase != PHASE_CHOOSE_TAILS && phase != PHASE_RE_WIDTH && phase != PHASE_PRETTY_WIDTH )
+      trace_memory(as, now.wall);
+  }
+  as->phase_times[phase].wall += now.wall - as->phase_mark.wall;
+  as->phase_times[phase].cpu  += now.cpu  - as->phase_mark.cpu;
+  as->phase_mark = now;
+}
+
+/* count_states()
+ * Count the positions resolved by each chosen_tail_state, before output() moves them on to *_DONE
+ */
+static void count_states(struct augsuggest *as) {
+  int ndx;
+  unsigned int position;
+  for( ndx=0; ndx<as->num_groups; ndx++ ) {
+    struct group *group = as->all_groups[ndx];
+    for( position=1; position<=group->max_position; position++ ) {
+      if( group->chosen_tail_state[position] <= NO_CHILD_NODES )
+        as->state_counts[group->chosen_tail_state[position]]++;
+    }
+  }
+}
+
+/* output_stats()
+ * --stats, write the time taken by each phase and the size of the analysis structures to fp
+ */
+static void output_stats(struct augsuggest *as, FILE *fp) {
+  struct rusage usage;
+  unsigned long num_tails=0, num_stubs=0, num_subgroups=0;
+  unsigned int max_positions_seen=0;
+  struct phase_time total = { 0, 0 };
+  int ndx, phase, state;
+  const char *sep;
+
+  for( ndx=0; ndx<as->num_groups; ndx++ ) {
+    struct group *group = as->all_groups[ndx];
+    struct tail *tail;
+    struct subgroup *subgroup;
+    unsigned int position;
+    for( tail=group->all_tails; tail != NULL; tail=tail->next )
+      num_tails++;
+    for( position=1; position<=group->max_position; position++ ) {
+      struct tail_stub *stub;
+      for( stub=group->tails_at_position[position]; stub != NULL; stub=stub->next )
+        num_stubs++;
+    }
+    for( subgroup=group->subgroups; subgroup != NULL; subgroup=subgroup->next )
+      num_subgroups++;
+    max_positions_seen = MAX(max_positions_seen, group->max_position);
+  }
+  for( phase=0; phase<NUM_PHASES; phase++ ) {
+    total.wall += as->phase_times[phase].wall;
+    total.cpu  += as->phase_times[phase].cpu;
+  }
+  getrusage(RUSAGE_SELF, &usage);   /* ru_maxrss is in kilobytes, for the whole process, not just this context */
+
+  if( as->show_stats == STATS_JSON ) {
+    fprintf(fp, "{\"phases\":{");
+    for( phase=0; phase<NUM_PHASES; phase++ ) {
+      fprintf(fp, "%s\"%s\":{\"wall_ms\":%.3f,\"cpu_ms\":%.3f}", phase ? "," : "", phase_names[phase], as->phase_times[phase].wall*1000, as->phase_times[phase].cpu*1000);
+    }
+    fprintf(fp, "},\"total\":{\"wall_ms\":%.3f,\"cpu_ms\":%.3f}", total.wall*1000, total.cpu*1000);
+    fprintf(fp, ",\"paths\":%d,\"groups\":%u,\"tails\":%lu,\"stubs\":%lu,\"subgroups\":%lu,\"max_positions\":%u,\"values\":%u",
+                    as->num_matched, as->num_groups, num_tails, num_stubs, num_subgroups, max_positions_seen, as->value_dict_count);
+    fprintf(fp, ",\"states\":{");
+    sep = "";
+    for( state=0; state<=NO_CHILD_NODES; state++ ) {
+      if( as->state_counts[state] == 0 )
+        continue;
+      fprintf(fp, "%s\"%s\":%u", sep, chosen_tail_state_name(state), as->state_counts[state]);
+      sep = ",";
+    }
+    fprintf(fp, "},\"process_peak_rss_kb\":%ld}\n", usage.ru_maxrss);
+    return;
+  }
+  fprintf(fp, "%-20s %12s %12s\n", "phase", "wall_ms", "cpu_ms");
+  for( phase=0; phase<NUM_PHASES; phase++ ) {
+    fprintf(fp, "%-20s %12.3f %12.3f\n", phase_names[phase], as->phase_times[phase].wall*1000, as->phase_times[phase].cpu*1000);
+  }
+  fprintf(fp, "%-20s %12.3f %12.3f\n", "total", total.wall*1000, total.cpu*1000);
+  fprintf(fp, "%-20s %12d\n",  "paths",         as->num_matched);
+  fprintf(fp, "%-20s %12u\n",  "groups",        as->num_groups);
+  fprintf(fp, "%-20s %12lu\n", "tails",         num_tails);
+  fprintf(fp, "%-20s %12lu\n", "stubs",         num_stubs);
+  fprintf(fp, "%-20s %12lu\n", "subgroups",     num_subgroups);
+  fprintf(fp, "%-20s %12u\n",  "max_positions", max_positions_seen);
+  fprintf(fp, "%-20s %12u\n",  "values",        as->value_dict_count);
+  for( state=0; state<=NO_CHILD_NODES; state++ ) {
+    if( as->state_counts[state] == 0 )
+      continue;
+    fprintf(fp, "%-34s %6u\n", chosen_tail_state_name(state), as->state_counts[state]);
+  }
+  fprintf(fp, "%-20s %12ld\n", "process_peak_rss_kb", usage.ru_maxrss);
+}
+
+/* output_alloc_stats()
+ * --alloc-stats, write the allocations counted for each structure type and each phase to fp
+ * For the phases, live is the total allocated at the end of the phase, and peak the highest total during it
+ */
+static void output_alloc_stats(struct augsuggest *as, FILE *fp) {
+  int ndx;
+  if( as->alloc_stats == STATS_JSON ) {
+    fprintf(fp, "{\"alloc\":{");
+    for( ndx=0; ndx<NUM_ALLOC_TYPES; ndx++ ) {
+      struct alloc_count *counts = &as->alloc_types[ndx];
+      fprintf(fp, "\"%s\":{\"count\":%lu,\"bytes\":%zu,\"live\":%zu,\"peak\":%zu},",
+                  alloc_type_names[ndx], counts->count, counts->bytes, counts->live, counts->peak);
+    }
+    fprintf(fp, "\"total\":{\"count\":%lu,\"bytes\":%zu,\"live\":%zu,\"peak\":%zu}},\"phases\":{",
+                as->alloc_total.count, as->alloc_total.bytes, as->alloc_total.live, as->alloc_total.peak);
+    for( ndx=0; ndx<NUM_PHASES; ndx++ ) {
+      struct alloc_count *counts = &as->alloc_phases[ndx];
+      fprintf(fp, "%s\"%s\":{\"count\":%lu,\"bytes\":%zu,\"live\":%zu,\"peak\":%zu}", ndx ? "," : "",
+                  phase_names[ndx], counts->count, counts->bytes, counts->live, counts->peak);
+    }
+    fprintf(fp, "}}\n");
+    return;
+  }
+  fprintf(fp, "%-20s %12s %14s %14s %14s\n", "alloc", "count", "bytes", "live", "peak");
+  for( ndx=0; ndx<NUM_ALLOC_TYPES; ndx++ ) {
+    struct alloc_count *counts = &as->alloc_types[ndx];
+    fprintf(fp, "%-20s %12lu %14zu %14zu %14zu\n", alloc_type_names[ndx], counts->count, counts->bytes, counts->live, counts->peak);
+  }
+  fprintf(fp, "%-20s %12lu %14zu %14zu %14zu\n", "total", as->alloc_total.count, as->alloc_total.bytes, as->alloc_total.live, as->alloc_total.peak);
+  fprintf(fp, "%-20s %12s %14s %14s %14s\n", "phase", "count", "bytes", "live", "peak");
+  for( ndx=0; ndx<NUM_PHASES; ndx++ ) {
+    struct alloc_count *counts = &as->alloc_phases[ndx];
+    fprintf(fp, "%-20s %12lu %14zu %14zu %14zu\n", phase_names[ndx], counts->count, counts->bytes, counts->live, counts->peak);
+  }
+}
+
+/* group_work()
+ * --group-profile, estimated work for a group: the candidate tails examined by choose_tail(),
+ * plus the tail map entries, which find_or_create_tail() and grow_position_arrays() initialise and copy
+ */
+static unsigned long group_work(struct group *group) {
+  unsigned long num_tails = 0;
+  struct tail *tail;
+  for( tail=group->all_tails; tail != NULL; tail=tail->next )
+    num_tails++;
+  return( group->candidates_examined + num_tails * group->position_array_size );
+}
+
+/* cmp_group_rank()
+ * qsort() comparison for --group-profile, most work first, then by head
+ */
+static int cmp_group_rank(const void *p1, const void *p2) {
+  const struct group_rank *r1 = p1;
+  const struct group_rank *r2 = p2;
+  if( r1->work != r2->work )
+    return( r1->work < r2->work ? 1 : -1 );
+  return( strcmp(r1->group->head, r2->group->head) );
+}
+
+/* output_group_profile()
+ * --group-profile, write the groups with the most work to fp, with the size of their structures,
+ * the time taken to choose their tails, and the number of positions resolved by each chosen_tail_state
+ */
+static void output_group_profile(struct augsuggest *as, FILE *fp) {
+  struct group_rank *sorted;
+  unsigned int ndx, num_shown;
+
+  sorted = malloc(sizeof(struct group_rank) * (as->num_groups + 1));
+  if( sorted == NULL )
+    return;
+  for( ndx=0; ndx<as->num_groups; ndx++ ) {
+    sorted[ndx].group = as->all_groups[ndx];
+    sorted[ndx].work  = group_work(as->all_groups[ndx]);
+  }
+  qsort(sorted, as->num_groups, sizeof(struct group_rank), cmp_group_rank);
+  num_shown = MIN(as->group_profile, as->num_groups);
+
+  fprintf(fp, "top %u of %u groups by work (candidates examined + tail map entries)\n", num_shown, as->num_groups);
+  fprintf(fp, "%10s %8s %6s %6s %9s %10s %10s %10s %11s  %s\n",
+              "work", "max_pos", "tails", "stubs", "subgroups", "pos_bytes", "map_bytes", "choose_ms", "re_width_ms", "head");
+  for( ndx=0; ndx<num_shown; ndx++ ) {
+    struct group *group = sorted[ndx].group;
+    unsigned long num_tails=0, num_stubs=0, num_subgroups=0;
+    unsigned int state_counts[NO_CHILD_NODES+1];
+    unsigned int position, state;
+    struct tail *tail;
+    struct subgroup *subgroup;
+    for( tail=group->all_tails; tail != NULL; tail=tail->next )
+      num_tails++;
+    for( subgroup=group->subgroups; subgroup != NULL; subgroup=subgroup->next )
+      num_subgroups++;
+    memset(state_counts, 0, sizeof(state_counts));
+    for( position=1; position<=group->max_position; position++ ) {
+      struct tail_stub *stub;
+      for( stub=group->tails_at_position[position]; stub != NULL; stub=stub->next )
+        num_stubs++;
+      /* initial_state is the state chosen by choose_tail(), output moves chosen_tail_state on to *_DONE */
+      if( group->initial_state != NULL && group->initial_state[position] <= NO_CHILD_NODES )
+        state_counts[group->initial_state[position]]++;
+    }
+    fprintf(fp, "%10lu %8u %6lu %6lu %9lu %10zu %10zu %10.3f %11.3f  %s\n",
+                sorted[ndx].work, group->max_position, num_tails, num_stubs, num_subgroups,
+                POSITION_ARRAYS_BYTES * group->position_array_size, 2 * sizeof(unsigned int) * group->position_array_size * num_tails,
+                group->choose_time*1000, group->re_width_time*1000, group->head);
+    fprintf(fp, "%10s", "");
+    for( state=0; state<=NO_CHILD_NODES; state++ ) {
+      if( state_counts[state] > 0 )
+        fprintf(fp, " %s=%u", chosen_tail_state_name(state), state_counts[state]);
+    }
+    fprintf(fp, "\n");
+  }
+  free(sorted);
+}
+
+static int cmp_str_ptr(const void *p1, const void *p2) {
+  return(strcmp(*(char * const *) p1, *(char * const *) p2));
+}
+
+/* select_query_paths()
+ * Mark the paths matched by the --query path-expressions (and their child nodes) as selected
+ * and mark every group position used by those paths, so that choose_all_tails() only needs
+ * to choose tails for the groups and positions which will actually be output
+ */
+static void select_query_paths(struct augsuggest *as) {
+  char **query_matches = NULL;
+  int    num_query_matches = 0;
+  int    ndx, qndx;
+  char  *selected_root = NULL;   /* most recent path matched by a query - its child nodes follow it directly */
+  struct path_segment *ps_ptr;
+
+  for( qndx=0; qndx < as->num_queries; qndx++ ) {
+    char **matches;
+    char **query_matches_realloc;
+    int num = aug_match(as->aug, as->queries[qndx], &matches);
+    if( num < 0 ) {
+      fatal(as, "Invalid --query path-expression: %s", as->queries[qndx]);
+    } else if ( num == 0 ) {
+      fprintf(stderr, "Warning: --query %s does not match any path\n", as->queries[qndx]);
+      continue;
+    }
+    query_matches_realloc = reallocarray(query_matches, sizeof(char *), num_query_matches + num);
+    CHECK_OOM( ! query_matches_realloc, fail_oom, "in select_query_paths()");
+
+    query_matches = query_matches_realloc;
+    memcpy(query_matches + num_query_matches, matches, sizeof(char *) * num);
+    num_query_matches += num;
+    free(matches);
+  }
+  qsort(query_matches, num_query_matches, sizeof(char *), cmp_str_ptr);
+
+  for( ndx=0; ndx < as->num_matched; ndx++ ) {
+    struct augeas_path_value *path_value = as->all_augeas_paths[ndx];
+    char *path = path_value->path;
+    path_value->selected = 0;
+    if( num_query_matches > 0 && bsearch(&path, query_matches, num_query_matches, sizeof(char *), cmp_str_ptr) ) {
+      selected_root = path;
+      path_value->selected = 1;
+    } else if ( selected_root != NULL && str_ischild(selected_root, path) ) {
+      path_value->selected = 1;
+    }
+    if( ! path_value->selected )
+      continue;
+    LOG(LOG_GROUP, LOG_DETAIL, "select_query_paths() %s", path);
+    for( ps_ptr=path_value->segments; ps_ptr != NULL; ps_ptr=ps_ptr->next ) {
+      struct group *group = ps_ptr->group;
+      if( group == NULL )
+        continue;
+      if( group->selected == NULL ) {
+        group->selected = calloc(group->position_array_size, sizeof(unsigned char));
+        CHECK_OOM( ! group->selected, fail_oom, "in select_query_paths()");
+        ACCOUNT_ALLOC(ALLOC_POSITION_ARRAYS, 1, 0, sizeof(unsigned char) * group->position_array_size);
+      }
+      group->selected[ps_ptr->position] = 1;
+    }
+  }
+  for( qndx=0; qndx < num_query_matches; qndx++ ) {
+    free(query_matches[qndx]);
+  }
+  free(query_matches);
+}
+
+/* populate group->chosen_tail[] and group->first_tail[] arrays */
+/* Also call choose_re_width() and choose_pretty_width() to populate group->re_width_ct[] ..->re_width_ft[] and ..->pretty_width_ft[] */
+static void choose_all_tails(struct augsuggest *as) {
+  int ndx;   /* index to all_groups() */
+  unsigned int position;
+  struct group *group;
+  struct phase_time group_start = { 0, 0 }, start, end;   /* --group-profile and --trace */
+  for(ndx=0; ndx<as->num_groups; ndx++) {
+    group=as->all_groups[ndx];
+    if( as->num_queries > 0 && group->selected == NULL ) {
+      /* --query given, and no selected path uses this group */
+      continue;
+    }
+    PROBE2(group_start, group->head, group->max_position);
+    if( as->group_profile || as->trace_fp ) {
+      stats_now(&start);
+      /* the group's phase spans start at phase_mark, so does the group span which contains them */
+      group_start = as->phase_mark;
+    }
+    for(position=1; position<=group->max_position; position++) {
+      /* find_first_tail() - find first "significant" tail
+       * populate group->first_tail[] before calling choose_tail()
+       * We need these values for find_or_create_subgroup()
+       */
+      group->first_tail[position] = find_first_tail(group->tails_at_position[position]);
+    }
+    if( as->use_regexp ) {
+      /* tail->re_width is used by tail_cost(), as well as by choose_re_width() */
+      find_re_widths(as, group);
+    }
+    find_group_key(as, group);
+    if( as->max_positions && group->max_position > as->max_positions ) {
+      degrade_group(as, group, 1, "--max-positions");
+    } else {
+      for(position=1; position<=group->max_position; position++) {
+        if( ! position_selected(as, group, position) ) {
+          continue;
+        }
+        if( as->time_limit > 0 && elapsed_time(as) > as->time_limit ) {
+          degrade_group(as, group, position, "--time-limit");
+          break;
+        }
+        group->chosen_tail[position] = choose_tail(as, group, position);
+        if( group->chosen_tail_state[position] == NOT_DONE ) {
+          /* choose_tail() exceeded --time-limit before it found a tail */
+          degrade_group(as, group, position, "--time-limit");
+          break;
+        }
+        if( as->max_candidates && group->candidates_examined > as->max_candidates && position < group->max_position ) {
+          degrade_group(as, group, position+1, "--max-candidates");
+          break;
+        }
+      }
+    }
+    if( as->group_profile || as->trace_fp ) {
+      stats_now(&end);
+      group->choose_time += end.wall - start.wall;
+    }
+    stats_phase_end(as, PHASE_CHOOSE_TAILS);
+    if( as->use_regexp ) {
+      if( as->group_profile || as->trace_fp )
+        stats_now(&start);
+      choose_re_width(as, group);
+      if( as->group_profile || as->trace_fp ) {
+        stats_now(&end);
+        group->re_width_time += end.wall - start.wall;
+      }
+      stats_phase_end(as, PHASE_RE_WIDTH);
+    }
+    if( as->pretty ) {
+      choose_pretty_width(as, group);
+      stats_phase_end(as, PHASE_PRETTY_WIDTH);
+    }
+    if( as->trace_fp )
+      trace_span(as, "group", "choose", group_start.wall, as->phase_mark.wall, group);
+    PROBE2(group_end, group->head, group->candidates_examined);
+  }
+  if( as->trace_fp )
+    trace_memory(as, as->phase_mark.wall);
+}
+
+/* quoted_length()
+ * Length of the value once quoted, using single quotes if possible
+ * Quotes are not strictly required for the value, but they _are_ required
+ * for values within the path-expressions
+ * The quote character to use is returned in *quote_p (if not NULL)
+ */
+static unsigned int quoted_length(const char *value, char *quote_p) {
+  const char *s;
+  char quote;
+  int len=0;
+  int has_q=0;
+  int has_qq=0;
+  int has_nl=0;
+  int new_len;
+  for(s = value, len=0; *s; s++, len++) {
+    switch(*s) {
+      case '"': has_qq++; break;
+      case '\'': has_q++; break;
+      case '\n':
+      case '\t':
+      case '\\':
+        has_nl++; break;
+      default:
+    }
+  }
+  if( has_q == 0 ) {
+    /* Normal case, no single-quotes within the value */
+    new_len = len+2+has_nl;
+    quote='\'';
+  } else if ( has_qq == 0 ) {
+    new_len = len+2+has_nl;
+    quote='"';
+  } else {
+    /* This needs a bugfix in augeas */
+    new_len = len+2+has_q+has_nl;
+    quote='\'';
+  }
+  if( quote_p )
+    *quote_p = quote;
+  return(new_len);
+}
+
+/* quote_into()
+ * Write the quoted and escaped value to t, which must have room for quoted_length() chars
+ * No \0 is appended
+ */
+static void quote_into(char *t, const char *value, char quote) {
+  const char *s;
+  *t++ = quote;
+  for(s = value; *s; s++, t++) {
+    if ( *s == quote ) {
+      *t++ = '\\';
+      *t =quote;
+      continue;
+    }  else if ( *s == '\n' ) {
+      *t++ = '\\';
+      *t = 'n';
+      continue;
+    }  else if ( *s == '\t' ) {
+      *t++ = '\\';
+      *t = 't';
+      continue;
+    }  else if ( *s == '\\' ) {
+      *t++ = '\\';
+      *t = '\\';
+      continue;
+    }
+    *t = *s;
+  }
+  *t = quote;
+}
+
+/* Create a quoted regular expression from the value, using single quotes if possible
+ */
+static char *regexp_value(struct augsuggest *as, char *value, int max_len) {
+  char *s, *t, *value_re, quote;
+  int len=0;
+  int has_q=0;
+  int has_qq=0;
+  int has_special=0;
+  int has_nl=0;
+  int new_len;
+  if(value==NULL)
+    return(NULL);
+  for(s = value, len=0; *s; s++, len++) {
+    switch(*s) {
+      case '"':  has_qq++; break;
+      case '\'': has_q++; break;
+      case '*':
+      case '?':
+      case '.':
+      case '[':
+      case ']':
+      case '(':
+      case ')':
+      case '^':
+      case '$':
+      case '|':
+        has_special++; break;
+      case '\n':
+      case '\t':
+        has_nl++; break;
+      case '\\':
+        has_special+=2; break;
+      default:
+    }
+  }
+  len++;  /* don't forget the \0 */
+  if( has_q == 0 ) {
+    /* Normal case, no single-quotes within the value */
+    new_len = len+2+has_nl+has_special*2;
+    quote='\'';
+  } else if ( has_qq == 0 ) {
+    new_len = len+2+has_nl+has_special*2;
+    quote='"';
+  } else {
+    /* This needs a bugfix in augeas */
+    new_len = len+2+has_q+has_nl+has_special*2;
+    quote='\'';
+  }
+  value_re = malloc( sizeof(char) * new_len);
+  CHECK_OOM( ! value_re, fail_oom, "in regexp_value()");
+  ACCOUNT_ALLOC(ALLOC_REGEXP, 1, 0, new_len);
+
+  t=value_re;
+  *t++ = quote;
+  for(s = value; *s; s++, t++) {
+    if ( *s == quote ) {
+      *t++ = '\\';
+      *t =quote;
+      continue;
+    }  else if ( *s == '\n' ) {
+      *t++ = '\\';
+      *t = 'n';
+      continue;
+    }  else if ( *s == '\t' ) {
+      *t++ = '\\';
+      *t = 't';
+      continue;
+    }  else if ( *s == '\\' || *s == ']' ) {
+      *t = '.';
+      continue;
+    }
+    switch(*s) {
+      /* Special handling for ] */
+      case ']':
+        *t = '.'; continue;
+      case '[':
+        *t++ = '\\';
+        break;
+      case '*':
+      case '?':
+      case '.':
+      case '(':
+      case ')':
+      case '^':
+      case '$':
+      case '|':
+        *t++ = '\\';
+        *t++ = '\\';
+        break;
+      case '\\':
+      case '\n':
+      case '\t':
+        break;  /* already dealt with above */
+      default:
+    }
+    *t = *s;
+    if( ( s - value ) + 1 >= max_len  && *(s+1)!='\0' && *(s+2)!='\0' && *(s+3)!='\0' ) {
+      /* don't append .* if there are only one or two chars left in the string */
+      t++;
+      *t++='.';
+      *t++='*';
+      break;
+    }
+  }
+  *t++ = quote;
+  *t++ = '\0';
+  return(value_re);
+}
+
+static void add_query(struct augsuggest *as, char *query) {
+  char **queries_realloc;
+  queries_realloc = reallocarray(as->queries, sizeof(char *), as->num_queries+1);
+  CHECK_OOM( ! queries_realloc, fail_oom, "in add_query()");
+
+  as->queries = queries_realloc;
+  as->queries[as->num_queries++] = query;
+  LOG(LOG_GROUP, LOG_INFO, "query=%s", query);
+}
+
+/* ----- value dictionary ----- */
+static unsigned int value_hash(const char *value) {
+  /* FNV-1a */
+  unsigned int hash = 2166136261u;
+  for( ; *value; value++ ) {
+    hash ^= (unsigned char) *value;
+    hash *= 16777619u;
+  }
+  return(hash);
+}
+
+/* Double the size of the value_dict hash table, and re-hash the existing entries */
+static void grow_value_dict(struct augsuggest *as) {
+  struct value_entry **new_dict;
+  unsigned int new_size = as->value_dict_size ? as->value_dict_size * 2 : 1024;
+  unsigned int ndx;
+  new_dict = calloc(new_size, sizeof(struct value_entry *));
+  CHECK_OOM( ! new_dict, fail_oom, "in grow_value_dict()");
+  ACCOUNT_ALLOC(ALLOC_VALUE, 1, as->value_dict_size * sizeof(struct value_entry *), new_size * sizeof(struct value_entry *));
+
+  for( ndx=0; ndx < as->value_dict_size; ndx++ ) {
+    struct value_entry *entry, *next;
+    for( entry = as->value_dict[ndx]; entry != NULL; entry = next ) {
+      next = entry->next;
+      entry->next = new_dict[entry->hash % new_size];
+      new_dict[entry->hash % new_size] = entry;
+    }
+  }
+  free(as->value_dict);
+  as->value_dict = new_dict;
+  as->value_dict_size = new_size;
+}
+
+/* lookup_value()
+ * Find the value_entry for this value in the value dictionary, creating it if required
+ * Values are interned, so two paths have the same value if and only if they have the same value_entry
+ * Returns NULL if value is NULL
+ */
+static struct value_entry *lookup_value(struct augsuggest *as, char *value) {
+  struct value_entry *entry;
+  unsigned int hash;
+  if( value == NULL )
+    return(NULL);
+  hash = value_hash(value);
+  if( as->value_dict_size > 0 ) {
+    for( entry = as->value_dict[hash % as->value_dict_size]; entry != NULL; entry = entry->next ) {
+      if( entry->hash == hash && strcmp(entry->value, value) == 0 )
+        return(entry);
+    }
+  }
+  if( as->value_dict_count >= as->value_dict_size ) {
+    grow_value_dict(as);
+  }
+  entry = malloc(sizeof(struct value_entry));
+  CHECK_OOM( ! entry, fail_oom, "in lookup_value()");
+  ACCOUNT_ALLOC(ALLOC_VALUE, 1, 0, sizeof(struct value_entry));
+
+  entry->value    = value;
+  entry->regexps  = NULL;
+  entry->hash     = hash;
+  entry->next     = as->value_dict[hash % as->value_dict_size];
+  as->value_dict[hash % as->value_dict_size] = entry;
+  as->value_dict_count++;
+  return(entry);
+}
+
+/* value_regexp()
+ * Return regexp_value(entry->value, width), creating it only once for each entry and width
+ */
+static char *value_regexp(struct augsuggest *as, struct value_entry *entry, unsigned int width) {
+  struct value_re *re;
+  if( entry == NULL )
+    return(NULL);
+  for( re = entry->regexps; re != NULL; re = re->next ) {
+    if( re->width == width )
+      return(re->value_re);
+  }
+  re = malloc(sizeof(struct value_re));
+  CHECK_OOM( ! re, fail_oom, "in value_regexp()");
+  ACCOUNT_ALLOC(ALLOC_REGEXP, 1, 0, sizeof(struct value_re));
+
+  re->width    = width;
+  re->value_re = regexp_value(as, entry->value, width);
+  re->next     = entry->regexps;
+  entry->regexps = re;
+  return(re->value_re);
+}
+
+/* ----- libaugsuggest API, see libaugsuggest.h -----
+ * Each API function does setjmp(as->fail) before calling anything which may call fatal(),
+ * and API functions do not call each other
+ */
+
+/* check_options()
+ * Combinations of options which cannot work together
+ */
+static void check_options(struct augsuggest *as) {
+  if( as->diff && ( as->num_queries > 0 || as->output_format != FORMAT_TEXT ) ) {
+    fatal(as, "--diff cannot be used with --query or --format");
+  }
+}
+
+/* set_string_option()
+ * Replace *option with a copy of value
+ */
+static void set_string_option(struct augsuggest *as, char **option, const char *name, const char *value) {
+  if( value == NULL ) {
+    fatal(as, "option %s requires a value", name);
+  }
+  free(*option);
+  *option = strdup(value);
+  CHECK_OOM( ! *option, fail_oom, "in set_string_option()");
+}
+
+/* unsigned_option()
+ * The value of a numeric option, which must be a whole number from 0 to UINT_MAX
+ */
+static unsigned int unsigned_option(struct augsuggest *as, const char *name, const char *value) {
+  char *endptr;
+  unsigned long number;
+  errno = 0;
+  number = strtoul(value, &endptr, 0);
+  if( ! isdigit((unsigned char) *value) || *endptr != '\0' || errno != 0 || number > UINT_MAX ) {
+    fatal(as, "invalid --%s \"%s\", expected a whole number", name, value);
+  }
+  return((unsigned int) number);
+}
+
+/* seconds_option()
+ * The value of an option in seconds, which must be a number 0 or more, eg. 2.5
+ */
+static double seconds_option(struct augsuggest *as, const char *name, const char *value) {
+  char *endptr;
+  double number;
+  errno = 0;
+  number = strtod(value, &endptr);
+  if( endptr == value || *endptr != '\0' || errno != 0 || ! ( number >= 0 ) ) {
+    fatal(as, "invalid --%s \"%s\", expected a number of seconds", name, value);
+  }
+  return(number);
+}
+
+/* start_load()
+ * Common start of augsuggest_load_file() and augsuggest_load_text()
+ * Create the augeas handle, and find the lens for --target, if no --lens was given
+ */
+static void start_load(struct augsuggest *as, const char *filename) {
+  check_options(as);
+  if( as->aug != NULL ) {
+    fatal(as, "an input has already been loaded");
+  }
+  set_string_option(as, &as->input_file, "filename", filename);
+  cleanup_filepath(as->input_file);
+  PROBE1(file_start, as->input_file);
+  if( as->trace_fp )
+    trace_file(as, "B", as->input_file);
+
+  stats_now(&as->phase_mark);
+  as->aug = aug_init(NULL, as->loadpath, as->flags|AUG_NO_ERR_CLOSE|AUG_NO_LOAD);
+  CHECK_OOM( as->aug == NULL, fail_oom, "in aug_init()");
+  as->own_aug = 1;
+  stats_phase_end(as, PHASE_AUG_INIT);
+
+  if ( as->target_file != NULL && as->lens == NULL ) {
+    /* Infer the lens which applies to the --target_file option */
+    as->lens = find_lens_for_path(as, as->target_file);
+    if( as->lens == NULL ) {
+      fatal(as, "Aborting - no lens applies for target: %s", as->target_file);
+    }
+  }
+  if ( as->lens != NULL ) {
+    /* Explict lens given, or inferred from --target - the script starts by loading the target with it */
+    as->header = 1;
+  } else if( as->verbose ) {
+    /* --lens not specified, the default lens is written as a comment */
+    as->default_lens = find_lens_for_path(as, as->input_file);
+    if( as->default_lens == NULL ) {
+      fatal(as, "Aborting - no lens applies for target: %s", as->input_file);
+    }
+  }
+}
+
+/* finish_load()
+ * Common end of the augsuggest_load_*() functions, once the input is at files_root
+ * Known group keys are looked up by lens and by group head relative to the file
+ */
+static void finish_load(struct augsuggest *as, const char *lens_path) {
+  if( as->lens != NULL ) {
+    as->schema_lens = schema_lens_name(as, as->lens);
+  } else {
+    char *default_lens = find_lens_for_path(as, (char *) lens_path);
+    if( default_lens != NULL ) {
+      hold(as, default_lens);
+      as->schema_lens = schema_lens_name(as, default_lens);
+      release(as, default_lens);
+    }
+  }
+  read_key_schemas(as);
+  if( as->match_path == NULL ) {
+    /* There is a subtle difference between "/files//(star)" and "/files/descendant::(star)" in the order that matches appear */
+    /* descendant::* is better suited, as it allows us to prune out intermediate nodes with null values (directory-like nodes) */
+    /* These would be created implicity by "set" */
+    as->match_path = strdup("/files/descendant::*");
+    CHECK_OOM( ! as->match_path, fail_oom, "in finish_load()");
+  }
+  stats_phase_end(as, PHASE_LENS);
+}
+
+/* output_header()
+ * The augtool commands to load the target with the lens used for the input, if --lens or --target was given
+ * or with --verbose, the default lens as a comment
+ */
+static void output_header(struct augsuggest *as) {
+  const char *filename = as->files_root + strlen("/files");
+  if( as->header ) {
+    out_str(as, "setm /augeas/load/*[incl='");
+    out_str(as, filename);
+    out_str(as, "' and label() != '");
+    out_str(as, as->lens);
+    out_str(as, "']/excl '");
+    out_str(as, filename);
+    out_char(as, '\'');
+    out_end_line(as);
+    out_str(as, "transform ");
+    out_str(as, as->lens);
+    out_str(as, " incl ");
+    out_str(as, filename);
+    out_end_line(as);
+    out_str(as, "load-file ");
+    out_str(as, filename);
+    out_end_line(as);
+  } else if( as->default_lens != NULL ) {
+    out_str(as, "# Using default lens: ");
+    out_str(as, as->default_lens);
+    out_end_line(as);
+    out_str(as, "# transform ");
+    out_str(as, as->default_lens);
+    out_str(as, " incl ");
+    out_str(as, as->input_file);
+    out_end_line(as);
+  }
+}
+
+static void free_live_nodes(struct augsuggest *as) {
+  int ndx;
+  for( ndx=0; ndx<as->num_live; ndx++ ) {
+    free(as->live_nodes[ndx].path);
+  }
+  free(as->live_nodes);
+  free(as->live_sorted);
+  as->live_nodes  = NULL;
+  as->live_sorted = NULL;
+  as->num_live    = 0;
+}
+
+/* emit()
+ * Write the script, or the --diff commands, into out_sink
+ * The live target is parsed again each time, as --apply may have changed it
+ */
+static void emit(struct augsuggest *as, int header) {
+  if( ! as->analysed ) {
+    fatal(as, "the input has not been analysed");
+  }
+  check_options(as);
+  stats_now(&as->phase_mark);
+  restore_chosen_tail_states(as);
+  if( as->diff ) {
+    const char *root = as->root ? as->root : getenv("AUGEAS_ROOT");
+    char *live_file;
+    int result;
+    if( as->schema_lens == NULL ) {
+      fatal(as, "no lens is known for %s", as->files_root);
+    }
+    result = asprintf(&live_file, "%s%s", root ? root : "", as->files_root + strlen("/files"));
+    CHECK_OOM( result < 0, fail_oom, NULL);
+    hold(as, live_file);
+    free_live_nodes(as);
+    aug_rm(as->aug, DIFF_LIVE);
+    load_live_target(as, live_file);
+    release(as, live_file);
+    stats_phase_end(as, PHASE_DIFF);
+  }
+  if( header && as->output_format == FORMAT_TEXT ) {
+    output_header(as);
+  }
+  if( as->diff ) {
+    output_diff(as);
+  } else {
+    output(as);
+  }
+  out_flush(as);
+  stats_phase_end(as, PHASE_OUTPUT);
+}
+
+/* emit_buffer()
+ * emit() into a malloc()ed, null terminated buffer, which is returned
+ * The header lines are left out unless header is set
+ */
+static char *emit_buffer(struct augsuggest *as, int header, size_t *len) {
+  char *buf;
+  as->out_sink.len = 0;
+  emit(as, header);
+  *out_reserve(as, 1) = '\0';
+  buf = as->out_sink.buf;
+  if( len != NULL )
+    *len = as->out_sink.len;
+  as->out_sink.buf  = NULL;
+  as->out_sink.len  = 0;
+  as->out_sink.size = 0;
+  return(buf);
+}
+
+static void free_groups(struct augsuggest *as) {
+  unsigned int ndx, position;
+  for( ndx=0; ndx<as->num_groups; ndx++ ) {
+    struct group *group = as->all_groups[ndx];
+    struct tail *tail, *next_tail;
+    struct tail_stats *stats, *next_stats;
+    struct subgroup *subgroup, *next_subgroup;
+    for( tail=group->all_tails; tail != NULL; tail=next_tail ) {
+      next_tail = tail->next;
+      free(tail->tail_found_map);
+      free(tail->tail_value_found_map);
+      free(tail);
+    }
+    for( stats=group->tail_stats; stats != NULL; stats=next_stats ) {
+      next_stats = stats->next;
+      free(stats);
+    }
+    for( subgroup=group->subgroups; subgroup != NULL; subgroup=next_subgroup ) {
+      next_subgroup = subgroup->next;
+      free(subgroup->matching_positions);
+      free(subgroup);
+    }
+    for( position=0; position<group->position_array_size; position++ ) {
+      struct tail_stub *stub, *next_stub;
+      for( stub=group->tails_at_position[position]; stub != NULL; stub=next_stub ) {
+        next_stub = stub->next;
+        free(stub);
+      }
+      if( group->rendered != NULL )
+        free(group->rendered[position]);
+    }
+    /* group->head belongs to the path_segment which created the group */
+    free(group->schema_head);
+    free(group->tails_at_position);
+    free(group->chosen_tail);
+    free(group->first_tail);
+    free(group->chosen_tail_state);
+    free(group->subgroup_position);
+    free(group->selected);
+    free(group->pretty_width_ct);
+    free(group->rendered);
+    free(group->rendered_len);
+    free(group->rendered_state);
+    free(group->initial_state);
+    free(group->re_width_ct);
+    free(group->re_width_ft);
+    free(group);
+  }
+  free(as->all_groups);
+}
+
+/* free_paths()
+ * The paths from aug_match(), and their path_segments
+ * tail->simple_tail and tail_stats->simple_tail point into the segments, so free_groups() comes first
+ */
+static void free_paths(struct augsuggest *as) {
+  int ndx;
+  if( as->all_augeas_paths != NULL ) {
+    for( ndx=0; ndx<as->num_matched; ndx++ ) {
+      struct path_segment *ps_ptr, *next_ps;
+      if( as->all_augeas_paths[ndx] == NULL )
+        continue;
+      for( ps_ptr=as->all_augeas_paths[ndx]->segments; ps_ptr != NULL; ps_ptr=next_ps ) {
+        next_ps = ps_ptr->next;
+        free(ps_ptr->head);
+        free(ps_ptr->simplified_tail);
+        free(ps_ptr);
+      }
+      free(as->all_augeas_paths[ndx]);
+    }
+    free(as->all_augeas_paths);
+  }
+  for( ndx=0; ndx<as->num_matched; ndx++ ) {
+    free(as->all_matches[ndx]);
+  }
+  free(as->all_matches);
+}
+
+/* free_value_dict()
+ * The values themselves belong to augeas
+ */
+static void free_value_dict(struct augsuggest *as) {
+  unsigned int ndx;
+  for( ndx=0; ndx<as->value_dict_size; ndx++ ) {
+    struct value_entry *entry, *next_entry;
+    for( entry=as->value_dict[ndx]; entry != NULL; entry=next_entry ) {
+      struct value_re *re, *next_re;
+      next_entry = entry->next;
+      for( re=entry->regexps; re != NULL; re=next_re ) {
+        next_re = re->next;
+        free(re->value_re);
+        free(re);
+      }
+      free(entry);
+    }
+  }
+  free(as->value_dict);
+}
+
+static void free_key_schemas(struct augsuggest *as) {
+  struct key_schema *schema, *next_schema;
+  for( schema=as->key_schemas; schema != NULL; schema=next_schema ) {
+    next_schema = schema->next;
+    if( ! schema->builtin ) {
+      free(schema->lens);
+      free(schema->head);
+      free(schema->key_tail);
+    }
+    free(schema);
+  }
+}
+
+augsuggest *augsuggest_new(void) {
+  struct augsuggest *as = calloc(1, sizeof(struct augsuggest));
+  if( as == NULL )
+    return(NULL);
+  as->flags       = AUG_NONE;
+  as->out_sink.fd = -1;
+  as->log_limit   = LOG_DEFAULT_LIMIT;
+  clock_gettime(CLOCK_MONOTONIC, &as->start_time);
+  return(as);
+}
+
+void augsuggest_free(augsuggest *as) {
+  int ndx;
+  if( as == NULL )
+    return;
+  if( as->aug != NULL ) {
+    PROBE1(file_end, as->input_file ? as->input_file : as->files_root);
+    if( as->trace_fp )
+      trace_file(as, "E", NULL);
+  }
+  if( as->trace_fp ) {
+    fprintf(as->trace_fp, "\n]\n");
+    fclose(as->trace_fp);
+  }
+  log_phase_end(as);
+  free(as->log_buf);
+  free_held(as);
+  free_groups(as);
+  free_paths(as);
+  free_value_dict(as);
+  free_key_schemas(as);
+  free_live_nodes(as);
+  for( ndx=0; ndx<as->num_queries; ndx++ ) {
+    free(as->queries[ndx]);
+  }
+  free(as->queries);
+  free(as->match_path);
+  free(as->error);
+  free(as->lens);
+  free(as->target_file);
+  free(as->root);
+  free(as->input_file);
+  free(as->default_lens);
+  free(as->schema_file);
+  free(as->schema_lens);
+  free(as->files_root);
+  free(as->out_sink.buf);
+  free(as->record_segs);
+  free(as->record_path);
+  if( as->own_aug )
+    aug_close(as->aug);
+  free(as);
+}
+
+const char *augsuggest_error(const augsuggest *as) {
+  return(as->error);
+}
+
+int augsuggest_set_option(augsuggest *as, const char *name, const char *value) {
+  if( setjmp(as->fail) )
+    return(-1);
+  LOG(LOG_INGEST, LOG_INFO, "option %s=%s", name, value ? value : "(null)");
+  if( strcmp(name, "verbose") == 0 ) {
+    as->verbose = 1;
+  } else if( strcmp(name, "debug") == 0 ) {
+    set_log_levels(as, value);
+  } else if( strcmp(name, "lens") == 0 ) {
+    set_string_option(as, &as->lens, name, value);
+    as->flags |= AUG_NO_MODL_AUTOLOAD;
+  } else if( strcmp(name, "noseq") == 0 ) {
+    as->noseq = 1;
+  } else if( strcmp(name, "seq") == 0 ) {
+    as->noseq = 0;
+  } else if( strcmp(name, "target") == 0 ) {
+    if( value == NULL || *value != '/' ) {
+      fatal(as, "target \"%s\" must be an absolute path\neg.\n\t--target=/etc/%s", value ? value : "", value ? value : "");
+    }
+    set_string_option(as, &as->target_file, name, value);
+  } else if( strcmp(name, "pretty") == 0 ) {
+    as->pretty = 1;
+  } else if( strcmp(name, "regexp") == 0 ) {
+    if( value ) {
+      int value_int = strtol(value, NULL, 0);
+      as->use_regexp = value_int > 0 ? value_int : 1;
+    } else {
+      as->use_regexp = 8;
+    }
+  } else if( strcmp(name, "query") == 0 ) {
+    char *query = NULL;
+    set_string_option(as, &query, name, value);
+    add_query(as, query);
+  } else if( strcmp(name, "max-positions") == 0 && value ) {
+    as->max_positions = unsigned_option(as, name, value);
+  } else if( strcmp(name, "max-candidates") == 0 && value ) {
+    as->max_candidates = unsigned_option(as, name, value);
+  } else if( strcmp(name, "time-limit") == 0 && value ) {
+    as->time_limit = seconds_option(as, name, value);
+  } else if( strcmp(name, "schema") == 0 ) {
+    set_string_option(as, &as->schema_file, name, value);
+  } else if( strcmp(name, "defnode") == 0 ) {
+    as->use_defnode = 1;
+  } else if( strcmp(name, "diff") == 0 ) {
+    as->diff = 1;
+  } else if( strcmp(name, "root") == 0 ) {
+    set_string_option(as, &as->root, name, value);
+  } else if( strcmp(name, "format") == 0 && value ) {
+    if( strcmp(value, "text") == 0 ) {
+      as->output_format = FORMAT_TEXT;
+    } else if( strcmp(value, "ndjson") == 0 ) {
+      as->output_format = FORMAT_NDJSON;
+    } else if( strcmp(value, "binary") == 0 ) {
+      as->output_format = FORMAT_BINARY;
+    } else {
+      fatal(as, "unknown --format \"%s\", expected text, ndjson or binary", value);
+    }
+  } else if( strcmp(name, "stats") == 0 ) {
+    if( value == NULL || strcmp(value, "text") == 0 ) {
+      as->show_stats = STATS_TEXT;
+    } else if( strcmp(value, "json") == 0 ) {
+      as->show_stats = STATS_JSON;
+    } else {
+      fatal(as, "unknown --stats \"%s\", expected text or json", value);
+    }
+  } else if( strcmp(name, "group-profile") == 0 ) {
+    as->group_profile = value ? unsigned_option(as, name, value) : 10;
+  } else if( strcmp(name, "trace") == 0 && value ) {
+    if( as->trace_fp != NULL ) {
+      fatal(as, "--trace may only be given once");
+    }
+    as->trace_fp = fopen(value, "w");
+    if( as->trace_fp == NULL ) {
+      fatal(as, "Could not open trace file %s: %s", value, strerror(errno));
+    }
+    fprintf(as->trace_fp, "[\n");
+    as->count_allocs = 1;
+  } else if( strcmp(name, "alloc-stats") == 0 ) {
+    as->count_allocs = 1;
+    if( value == NULL || strcmp(value, "text") == 0 ) {
+      as->alloc_stats = STATS_TEXT;
+    } else if( strcmp(value, "json") == 0 ) {
+      as->alloc_stats = STATS_JSON;
+    } else {
+      fatal(as, "unknown --alloc-stats \"%s\", expected text or json", value);
+    }
+  } else if( strcmp(name, "max-positions") == 0 || strcmp(name, "max-candidates") == 0
+          || strcmp(name, "time-limit") == 0 || strcmp(name, "format") == 0 || strcmp(name, "trace") == 0 ) {
+    fatal(as, "option %s requires a value", name);
+  } else {
+    fatal(as, "unknown option \"%s\"", name);
+  }
+  return(0);
+}
+
+int augsuggest_load_file(augsuggest *as, const char *filename) {
+  if( setjmp(as->fail) )
+    return(-1);
+  start_load(as, filename);
+
+  if ( as->lens != NULL ) {
+    LOG(LOG_INGEST, LOG_INFO, "Adding transform lens: %s   file: %s", as->lens, as->input_file);
+    if ( aug_transform(as->aug, as->lens, as->input_file, 0) != 0 ) {
+      fatal(as, "%s", aug_error_details(as->aug));
+    }
+  }
+  stats_phase_end(as, PHASE_LENS);
+
+  if ( aug_load_file(as->aug, as->input_file) != 0 || aug_error_details(as->aug) != NULL ) {
+    const char *msg = aug_error_details(as->aug);
+    const char *minor = aug_error_minor_message(as->aug);
+    if( msg ) {
+      fatal(as, "Failed to load file %s\n%s", as->input_file, msg);
+    }
+    msg = aug_error_message(as->aug);
+    fatal(as, "Failed to load file %s%s%s%s%s", as->input_file, msg ? "\n" : "", msg ? msg : "", minor ? "\n" : "", minor ? minor : "");
+  }
+  LOG(LOG_INGEST, LOG_INFO, "errno=%d %s", errno, aug_error_details(as->aug));
+  stats_phase_end(as, PHASE_LOAD_FILE);
+
+  if ( as->target_file ) {
+    /* Rename the tree from inputfile to target_file, if specified */
+    move_tree(as, as->input_file, as->target_file);
+  }
+  stats_phase_end(as, PHASE_MOVE_TREE);
+
+  {
+    int result = asprintf(&as->files_root, "/files%s", as->target_file ? as->target_file : as->input_file);
+    CHECK_OOM( result < 0, fail_oom, NULL);
+  }
+  finish_load(as, as->input_file);
+  return(0);
+}
+
+int augsuggest_load_text(augsuggest *as, const char *text, const char *filename) {
+  char *text_lens;
+  int result;
+  if( setjmp(as->fail) )
+    return(-1);
+  start_load(as, filename);
+  result = asprintf(&as->files_root, "/files%s", as->target_file ? as->target_file : as->input_file);
+  CHECK_OOM( result < 0, fail_oom, NULL);
+  finish_load(as, as->input_file);
+
+  /* The lens is given to aug_text_store() directly, there is no transform for the file */
+  if( as->flags & AUG_NO_MODL_AUTOLOAD ) {
+    /* explicit --lens */
+    text_lens = strdup(as->lens);
+    CHECK_OOM( ! text_lens, fail_oom, "in augsuggest_load_text()");
+  } else if( as->schema_lens != NULL ) {
+    text_lens = apply_lens_name(as);
+  } else {
+    fatal(as, "Aborting - no lens applies for target: %s", as->input_file);
+  }
+  hold(as, text_lens);
+  aug_set(as->aug, APPLY_TEXT, text);
+  if( aug_text_store(as->aug, text_lens, APPLY_TEXT, as->files_root) < 0 ) {
+    aug_rm(as->aug, APPLY_NODE);
+    fatal(as, "could not parse %s using lens %s: %s", as->input_file, text_lens, aug_error_details(as->aug) ? aug_error_details(as->aug) : aug_error_message(as->aug));
+  }
+  aug_rm(as->aug, APPLY_NODE);
+  release(as, text_lens);
+  stats_phase_end(as, PHASE_LOAD_FILE);
+  return(0);
+}
+
+int augsuggest_load_tree(augsuggest *as, augeas *aug, const char *path) {
+  int result;
+  if( setjmp(as->fail) )
+    return(-1);
+  check_options(as);
+  if( as->aug != NULL ) {
+    fatal(as, "an input has already been loaded");
+  }
+  if( strncmp(path, "/files/", strlen("/files/")) != 0 ) {
+    fatal(as, "%s is not below /files", path);
+  }
+  as->aug = aug;
+  set_string_option(as, &as->files_root, "path", path);
+  PROBE1(file_start, as->files_root);
+  if( as->trace_fp )
+    trace_file(as, "B", as->files_root);
+  result = asprintf(&as->match_path, "%s/descendant::*", path);
+  CHECK_OOM( result < 0, fail_oom, NULL);
+  stats_now(&as->phase_mark);
+  finish_load(as, path + strlen("/files"));
+  return(0);
+}
+
+int augsuggest_analyse(augsuggest *as) {
+  const char *value;  /* result of aug_get() */
+  int ndx;
+  if( setjmp(as->fail) )
+    return(-1);
+  if( as->aug == NULL ) {
+    fatal(as, "no input has been loaded");
+  }
+  if( as->analysed || as->all_matches != NULL ) {
+    /* all_matches is set once the analysis has started, even if it did not finish */
+    fatal(as, "the input has already been analysed");
+  }
+  stats_now(&as->phase_mark);
+
+  as->num_matched = aug_match(as->aug, as->match_path, &as->all_matches);
+  LOG(LOG_INGEST, LOG_INFO, "errno=%d %s", errno, aug_error_details(as->aug));
+  if( as->num_matched <= 0 ) {
+    as->num_matched = 0;
+    fatal(as, "Failed to parse file %s using lens %s", as->input_file ? as->input_file : as->files_root, as->lens ? as->lens : as->schema_lens ? as->schema_lens : "(none)");
+  }
+  stats_phase_end(as, PHASE_MATCH);
+  as->all_augeas_paths = (struct augeas_path_value **) calloc(as->num_matched, sizeof(struct augeas_path_value *));
+  CHECK_OOM( as->all_augeas_paths == NULL, fail_oom, NULL);
+
+  for (ndx=0; ndx < as->num_matched; ndx++) {
+    as->all_augeas_paths[ndx] = (struct augeas_path_value *) malloc( sizeof(struct augeas_path_value));
+    CHECK_OOM( as->all_augeas_paths[ndx] == NULL, fail_oom, NULL);
+    as->all_augeas_paths[ndx]->path = as->all_matches[ndx];
+    as->all_augeas_paths[ndx]->segments = NULL;
+    aug_get(as->aug, as->all_matches[ndx], &value );
+    LOG(LOG_INGEST, LOG_DETAIL, "%s %s", as->all_augeas_paths[ndx]->path, value);
+    as->all_augeas_paths[ndx]->dict     = lookup_value(as, (char *) value);
+    as->all_augeas_paths[ndx]->value    = value ? as->all_augeas_paths[ndx]->dict->value : NULL;
+    as->all_augeas_paths[ndx]->selected = 1;
+  }
+  stats_phase_end(as, PHASE_VALUES);
+  for (ndx=0; ndx < as->num_matched; ndx++) {
+    as->all_augeas_paths[ndx]->segments = split_path(as, as->all_augeas_paths[ndx]);
+  }
+  stats_phase_end(as, PHASE_SPLIT_PATH);
+  if( as->num_queries > 0 ) {
+    select_query_paths(as);
+  }
+  stats_phase_end(as, PHASE_QUERY);
+  choose_all_tails(as);
+  if( as->show_stats ) {
+    count_states(as);
+  }
+  /* output and apply each start from the states chosen here */
+  save_chosen_tail_states(as);
+  write_key_schemas(as);
+  /* only now can the input be output or applied */
+  as->analysed = 1;
+  return(0);
+}
+
+int augsuggest_output(augsuggest *as, augsuggest_writer writer, void *data) {
+  int result = 0;
+  if( setjmp(as->fail) ) {
+    result = -1;
+  } else {
+    as->out_sink.writer      = writer;
+    as->out_sink.writer_data = data;
+    emit(as, 1);
+  }
+  as->out_sink.writer      = NULL;
+  as->out_sink.writer_data = NULL;
+  as->out_sink.len         = 0;
+  return(result);
+}
+
+int augsuggest_output_fd(augsuggest *as, int fd) {
+  int result = 0;
+  if( setjmp(as->fail) ) {
+    result = -1;
+  } else {
+    as->out_sink.fd = fd;
+    emit(as, 1);
+  }
+  as->out_sink.fd  = -1;
+  as->out_sink.len = 0;
+  return(result);
+}
+
+char *augsuggest_output_buffer(augsuggest *as, size_t *len) {
+  if( setjmp(as->fail) ) {
+    as->out_sink.len = 0;
+    return(NULL);
+  }
+  return(emit_buffer(as, 1, len));
+}
+
+int augsuggest_apply(augsuggest *as, const char *root) {
+  char *apply_lens;
+  int result;
+  if( setjmp(as->fail) ) {
+    if( as->aug != NULL )
+      aug_rm(as->aug, APPLY_NODE);
+    return(-1);
+  }
+  if( ! as->analysed ) {
+    fatal(as, "the input has not been analysed");
+  }
+  if( as->schema_lens == NULL ) {
+    fatal(as, "no lens is known for %s", as->files_root);
+  }
+  stats_now(&as->phase_mark);
+  apply_lens = hold(as, apply_lens_name(as));
+  result = apply_to_root(as, root, apply_lens);
+  release(as, apply_lens);
+  stats_phase_end(as, PHASE_APPLY);
+  return(result);
+}
+
+int augsuggest_verify(augsuggest *as) {
+  char *lens, *script;
+  int result;
+  if( setjmp(as->fail) ) {
+    as->out_sink.len = 0;
+    restore_verify_input(as);
+    return(-1);
+  }
+  if( ! as->analysed ) {
+    fatal(as, "the input has not been analysed");
+  }
+  if( as->schema_lens == NULL ) {
+    fatal(as, "no lens is known for %s", as->files_root);
+  }
+  if( as->diff || as->num_queries > 0 || as->output_format != FORMAT_TEXT ) {
+    fatal(as, "--verify needs the whole script, it cannot be used with --diff, --query or --format");
+  }
+  lens = hold(as, apply_lens_name(as));
+  /* the script as augsuggest_output_buffer() writes it, without the header which loads the target from disk */
+  script = hold(as, emit_buffer(as, 0, NULL));
+  stats_now(&as->phase_mark);
+  aug_rm(as->aug, APPLY_NODE);
+  if( aug_mv(as->aug, as->files_root, VERIFY_INPUT) < 0 ) {
+    fatal(as, "could not move %s to %s: %s", as->files_root, VERIFY_INPUT, augeas_error_text(as));
+  }
+  result = verify_round_trip(as, lens, script);
+  restore_verify_input(as);
+  release(as, script);
+  release(as, lens);
+  stats_phase_end(as, PHASE_VERIFY);
+  return(result);
+}
+
+void augsuggest_print_stats(augsuggest *as, FILE *fp) {
+  if( as->show_stats )
+    output_stats(as, fp);
+  if( as->alloc_stats )
+    output_alloc_stats(as, fp);
+  if( as->group_profile )
+    output_group_profile(as, fp);
+}
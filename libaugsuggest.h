@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2022 George Hansper <george@hansper.id.au>
+ * -----------------------------------------------------------------------
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Author: George Hansper <george@hansper.id.au>
+ * -----------------------------------------------------------------------
+ *
+ * libaugsuggest - the augsuggest analysis as a library
+ *
+ * Typical use:
+ *
+ *   augsuggest *as = augsuggest_new();
+ *   augsuggest_set_option(as, "target", "/etc/hosts");
+ *   augsuggest_set_option(as, "pretty", NULL);
+ *   if( augsuggest_load_file(as, "/var/tmp/hosts.new") < 0
+ *     || augsuggest_analyse(as) < 0
+ *     || augsuggest_output_fd(as, 1) < 0 )
+ *     fprintf(stderr, "%s\n", augsuggest_error(as));
+ *   augsuggest_free(as);
+ *
+ * Each context holds one input file. All state lives in the context, so separate contexts
+ * may be used from separate threads at the same time; a single context must not be.
+ * Functions returning int return 0 on success, or -1 with the reason in augsuggest_error()
+ */
+
+#ifndef LIBAUGSUGGEST_H_
+#define LIBAUGSUGGEST_H_
+
+#include <stdio.h>
+#include <augeas.h>
+
+typedef struct augsuggest augsuggest;
+
+/* The variable name used by the "defnode" option, each entry is defined as $node */
+#define AUGSUGGEST_DEFNODE_VAR "node"
+
+/* Output callback - called with each block of the script, return < 0 to abort the output */
+typedef int (*augsuggest_writer)(void *data, const char *buf, size_t len);
+
+augsuggest *augsuggest_new(void);
+void augsuggest_free(augsuggest *as);
+
+/* The message for the last error, or NULL */
+const char *augsuggest_error(const augsuggest *as);
+
+/* Set an option, by the same name as the augsuggest command-line option without the leading --
+ * eg. ("target", "/etc/hosts"), ("regexp", "12"), ("pretty", NULL)
+ * Options must be set before loading the input
+ */
+int augsuggest_set_option(augsuggest *as, const char *name, const char *value);
+
+/* Load the input - only one of these per context
+ * augsuggest_load_file()  reads the file (below $AUGEAS_ROOT, if set)
+ * augsuggest_load_text()  parses text as if it had been read from filename
+ * augsuggest_load_tree()  uses the tree already loaded at path (eg. /files/etc/hosts) in aug
+ *                         aug is not closed by augsuggest_free()
+ */
+int augsuggest_load_file(augsuggest *as, const char *filename);
+int augsuggest_load_text(augsuggest *as, const char *text, const char *filename);
+int augsuggest_load_tree(augsuggest *as, augeas *aug, const char *path);
+
+/* Choose the path-expressions for every node of the input */
+int augsuggest_analyse(augsuggest *as);
+
+/* Write the script (or --diff, --format output), to a callback, a file descriptor, or a buffer
+ * augsuggest_output_buffer() returns a malloc()ed, null terminated buffer, or NULL on error
+ */
+int augsuggest_output(augsuggest *as, augsuggest_writer writer, void *data);
+int augsuggest_output_fd(augsuggest *as, int fd);
+char *augsuggest_output_buffer(augsuggest *as, size_t *len);
+
+/* Apply the set-commands directly to the target file below root, see --apply */
+int augsuggest_apply(augsuggest *as, const char *root);
+
+/* Run the script with aug_srun() on an empty tree, save and re-parse it, and compare it with the input node by node,
+ * then check that running it a second time makes no changes, see --verify
+ * The first difference found is given by augsuggest_error()
+ */
+int augsuggest_verify(augsuggest *as);
+
+/* Write the --stats, --alloc-stats and --group-profile reports (whichever were set) to fp */
+void augsuggest_print_stats(augsuggest *as, FILE *fp);
+
+#endif